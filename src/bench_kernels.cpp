@@ -0,0 +1,366 @@
+#include "sorted_coo.hpp"
+#include "shm_counting_set/shm_counting_set.h"
+#include "space_saving/space_saving.hpp"
+#include <stdio.h>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+
+/*
+    usage: bench_kernels [ops_per_rank] [key_space]
+
+    Times the inner pieces of spGemm on synthetic key streams, so a regression shows up on one node:
+        map_key hashing, get_owners() / owner_range() (with and without the owner table), the local row
+        lookup and scale_row() of the multiplier, proc_cache::cache_insert() / cache_flush_all() and
+        shm_counting_set::cache_insert() with every rank of the node inserting at once.
+    Each kernel runs on a uniform, a Zipf (s = 1.1) and a hub-heavy stream (half of the keys from 100 hubs).
+    The streams are seeded by rank, so runs with the same arguments and rank count see the same keys.
+    Reported: ns/op (slowest rank), aggregate Mops/s over all ranks and, for the caches, the hit rate
+    (proc_cache: inserts added to a cached entry; shm_counting_set: inserts that did not flush another key).
+    wire_codec is also reported as the size ratio of plain to packed batches, summed over all ranks.
+    Last, the top 100 keys of each stream from space_saving (default capacity and 1024) are compared with the
+    exact top 100 of a counting_set, as found / 100.
+*/
+
+enum class stream_kind{ uniform, zipf, hubs };
+
+const char* stream_name(stream_kind kind){
+    switch(kind){
+        case stream_kind::uniform: return "uniform";
+        case stream_kind::zipf: return "zipf";
+        default: return "hubs";
+    }
+}
+
+/*
+    @brief
+        "count" keys in [0, key_space) drawn from "kind", reproducible for a given seed.
+        Zipf ranks are scattered over the key space by a fixed permutation so hot keys are not all small.
+*/
+std::vector<int> make_stream(stream_kind kind, size_t count, int key_space, uint64_t seed){
+    std::mt19937_64 gen(seed);
+    std::vector<int> keys(count);
+    if(kind == stream_kind::uniform){
+        std::uniform_int_distribution<int> dist(0, key_space - 1);
+        for(int &key : keys){
+            key = dist(gen);
+        }
+        return keys;
+    }
+    if(kind == stream_kind::zipf){
+        constexpr double exponent = 1.1;
+        std::vector<double> cdf(key_space);
+        double total = 0;
+        for(int i = 0; i < key_space; i++){
+            total += 1.0 / std::pow(i + 1, exponent);
+            cdf[i] = total;
+        }
+        std::uniform_real_distribution<double> dist(0, total);
+        for(int &key : keys){
+            int rank = std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin();
+            key = int((uint64_t(std::min(rank, key_space - 1)) * 2654435761ULL) % uint64_t(key_space));
+        }
+        return keys;
+    }
+    constexpr int num_hubs = 100;
+    std::uniform_int_distribution<int> dist(0, key_space - 1);
+    std::uniform_int_distribution<int> hub(0, num_hubs - 1);
+    std::bernoulli_distribution is_hub(0.5);
+    for(int &key : keys){
+        key = is_hub(gen) ? int((uint64_t(hub(gen)) * 2654435761ULL) % uint64_t(key_space)) : dist(gen);
+    }
+    return keys;
+}
+
+/*
+    @brief (row, col) pairs: rows from the stream, columns from a second stream of the same kind
+*/
+std::vector<map_key> make_pair_stream(stream_kind kind, size_t count, int key_space, uint64_t seed){
+    std::vector<int> rows = make_stream(kind, count, key_space, seed);
+    std::vector<int> cols = make_stream(kind, count, key_space, seed ^ 0x9e3779b97f4a7c15ULL);
+    std::vector<map_key> keys(count);
+    for(size_t i = 0; i < count; i++){
+        keys[i] = {rows[i], cols[i]};
+    }
+    return keys;
+}
+
+/*
+    @brief prints one result line on rank 0. seconds is this rank's time for ops operations. Collective.
+
+    @param hit_rate: local hit rate, averaged over the ranks; negative if the kernel has none
+*/
+void report(ygm::comm &world, const std::string &kernel, stream_kind kind, size_t ops, double seconds,
+            double hit_rate = -1){
+    double slowest = ygm::max(seconds, world);
+    size_t total_ops = ygm::sum(ops, world);
+    double mean_hit_rate = ygm::sum(hit_rate, world) / world.size();
+    if(world.rank0()){
+        printf("%-28s %-8s %10.2f ns/op %12.2f Mops/s", kernel.c_str(), stream_name(kind),
+               ops > 0 ? slowest * 1e9 / ops : 0.0, slowest > 0 ? total_ops / slowest / 1e6 : 0.0);
+        if(hit_rate >= 0){
+            printf("   hit rate %5.1f%%", mean_hit_rate * 100);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+/*
+    @brief prints the plain / packed byte ratio of a message encoding, summed over the ranks. Collective.
+*/
+void report_ratio(ygm::comm &world, const std::string &kernel, stream_kind kind, size_t raw_bytes, size_t packed_bytes){
+    size_t total_raw = ygm::sum(raw_bytes, world);
+    size_t total_packed = ygm::sum(packed_bytes, world);
+    if(world.rank0()){
+        printf("%-28s %-8s %10.2f x smaller (%zu -> %zu bytes)\n", kernel.c_str(), stream_name(kind),
+               total_packed > 0 ? double(total_raw) / total_packed : 0.0, total_raw, total_packed);
+        fflush(stdout);
+    }
+}
+
+
+int main(int argc, char** argv){
+
+    ygm::comm world(&argc, &argv);
+
+    size_t ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int key_space = argc > 2 ? std::atoi(argv[2]) : 1 << 20;
+    const std::vector<stream_kind> kinds = {stream_kind::uniform, stream_kind::zipf, stream_kind::hubs};
+    world.cout0("bench_kernels: ", ops, " ops per rank, ", key_space, " keys, ", world.size(), " ranks");
+
+    /*
+        Synthetic B with Zipf row degrees (8 nonzeros per row on average), sorted by construction.
+        Every rank builds the rows of its own contiguous range.
+    */
+    int rows_per_rank = (key_space + world.size() - 1) / world.size();
+    int first_row = std::min(key_space, world.rank() * rows_per_rank);
+    int last_row = std::min(key_space, first_row + rows_per_rank);
+    std::vector<int> degree_draws = make_stream(stream_kind::zipf, size_t(last_row - first_row) * 8,
+                                                std::max(1, last_row - first_row), 7 + world.rank());
+    std::vector<int> degrees(std::max(0, last_row - first_row), 0);
+    for(int draw : degree_draws){
+        degrees[draw]++;
+    }
+    std::vector<Edge> local_B;
+    std::mt19937_64 col_gen(11 + world.rank());
+    std::uniform_int_distribution<int> col_dist(0, key_space - 1);
+    for(int row = first_row; row < last_row; row++){
+        std::vector<int> cols(degrees[row - first_row]);
+        for(int &col : cols){
+            col = col_dist(col_gen);
+        }
+        std::sort(cols.begin(), cols.end());
+        for(int col : cols){
+            local_B.push_back({row, col, 1});
+        }
+    }
+    Sorted_COO B(world, build_sorted_array(world, local_B), true);
+    csr_slice slice;
+    for(const Edge &ed : local_B){
+        slice.push_back(ed.row, ed.col, ed.value);
+    }
+    slice.finish();
+    world.barrier();
+
+    // owner lookups by binary search over the rank ranges, before build_owner_table() replaces it
+    for(stream_kind kind : kinds){
+        std::vector<int> rows = make_stream(kind, ops, key_space, 1000 * uint64_t(kind) + world.rank());
+        size_t sink = 0;
+        double start = MPI_Wtime();
+        for(int row : rows){
+            sink += B.get_owners(row).size();
+        }
+        report(world, "get_owners (search)", kind, ops, MPI_Wtime() - start);
+        start = MPI_Wtime();
+        for(int row : rows){
+            sink += B.owner_range(row).second;
+        }
+        report(world, "owner_range (search)", kind, ops, MPI_Wtime() - start);
+        if(sink == 42){
+            world.cout("");
+        }
+    }
+    world.cout0("");
+    B.build_owner_table();
+
+    for(stream_kind kind : kinds){
+        uint64_t seed = 1000 * uint64_t(kind) + world.rank();
+        std::vector<int> rows = make_stream(kind, ops, key_space, seed);
+        std::vector<map_key> pairs = make_pair_stream(kind, ops, key_space, seed);
+        world.barrier();
+
+        // map_key hashing: boost's hash_combine (hash_value) and the hash ygm's map and the caches use
+        size_t sink = 0;
+        double start = MPI_Wtime();
+        for(const map_key &key : pairs){
+            sink += hash_value(key);
+        }
+        report(world, "hash_value(map_key)", kind, ops, MPI_Wtime() - start);
+        start = MPI_Wtime();
+        for(const map_key &key : pairs){
+            sink += ygm::container::detail::hash<map_key>{}(key);
+        }
+        report(world, "ygm hash<map_key>", kind, ops, MPI_Wtime() - start);
+
+        // row owners through the per-row table
+        start = MPI_Wtime();
+        for(int row : rows){
+            sink += B.owner_range(row).second;
+        }
+        report(world, "owner_range (table)", kind, ops, MPI_Wtime() - start);
+
+        // the multiplier's local row lookup and the row kernel, on rows this rank holds
+        std::vector<int> local_rows = make_stream(kind, ops, std::max(1, last_row - first_row), seed + 1);
+        for(int &row : local_rows){
+            row += first_row;
+        }
+        start = MPI_Wtime();
+        for(int row : local_rows){
+            sink += slice.row_segment(row).second;
+        }
+        report(world, "row_segment", kind, ops, MPI_Wtime() - start);
+        std::vector<uint64_t> keys(degrees.empty() ? 1 : *std::max_element(degrees.begin(), degrees.end()) + 1);
+        std::vector<int> products(keys.size());
+        size_t products_made = 0;
+        start = MPI_Wtime();
+        for(int row : local_rows){
+            auto [begin, end] = slice.row_segment(row);
+            products_made += scale_row(slice.cols() + begin, slice.values() + begin, end - begin, 3, row,
+                                       keys.data(), products.data());
+        }
+        report(world, "row_segment + scale_row", kind, std::max<size_t>(1, products_made), MPI_Wtime() - start);
+        world.barrier();
+
+        // top-pair cache in front of a ygm map, sized k * k for k = 100 as in spGemm()
+        {
+            ygm::container::map<map_key, int> accum(world);
+            proc_cache<map_key, int> cache(world, accum, 100);
+            start = MPI_Wtime();
+            for(const map_key &key : pairs){
+                cache.cache_insert(key, 1);
+            }
+            double insert_time = MPI_Wtime() - start;
+            report(world, "proc_cache::cache_insert", kind, ops, insert_time, double(cache.hit_count()) / ops);
+            start = MPI_Wtime();
+            cache.cache_flush_all();
+            world.barrier();
+            report(world, "proc_cache flush + barrier", kind, ops, MPI_Wtime() - start);
+        }
+
+        /*
+            wire_codec on batches shaped like the expand-sort-compress stage: the pairs are split by the owner
+            of the key in flat_accumulator, cut into batches of 4096 and sorted. Each batch is packed once with
+            unit values (pattern-only products, as in the threaded row batches) and once with equal keys
+            combined into counts.
+        */
+        {
+            constexpr size_t batch_keys = 4096;
+            flat_accumulator<map_key, int>::owner_partitioner owners{world.size()};
+            std::vector<std::vector<uint64_t>> by_owner(world.size());
+            for(const map_key &key : pairs){
+                by_owner[owners.owner(key)].push_back(pack_key(key));
+            }
+            size_t raw_unit = 0;
+            size_t packed_unit = 0;
+            size_t raw_combined = 0;
+            size_t packed_combined = 0;
+            std::vector<uint8_t> out;
+            std::vector<uint64_t> keys;
+            std::vector<int> values;
+            start = MPI_Wtime();
+            for(const std::vector<uint64_t> &owner_keys : by_owner){
+                for(size_t begin = 0; begin < owner_keys.size(); begin += batch_keys){
+                    size_t end = std::min(owner_keys.size(), begin + batch_keys);
+                    keys.assign(owner_keys.begin() + begin, owner_keys.begin() + end);
+                    std::sort(keys.begin(), keys.end());
+                    values.assign(keys.size(), 1);
+                    out.clear();
+                    raw_unit += wire_codec<int>::raw_bytes(keys.size());
+                    packed_unit += wire_codec<int>::encode(keys, values, out);
+
+                    size_t distinct = 0;
+                    for(size_t i = 0; i < keys.size(); i++){
+                        if(distinct > 0 && keys[distinct - 1] == keys[i]){
+                            values[distinct - 1]++;
+                            continue;
+                        }
+                        keys[distinct] = keys[i];
+                        values[distinct] = 1;
+                        distinct++;
+                    }
+                    keys.resize(distinct);
+                    values.resize(distinct);
+                    out.clear();
+                    raw_combined += wire_codec<int>::raw_bytes(keys.size());
+                    packed_combined += wire_codec<int>::encode(keys, values, out);
+                }
+            }
+            report(world, "wire_codec pack (2 passes)", kind, ops, MPI_Wtime() - start);
+            report_ratio(world, "wire_codec (unit values)", kind, raw_unit, packed_unit);
+            report_ratio(world, "wire_codec (combined counts)", kind, raw_combined, packed_combined);
+        }
+
+        // node-shared cache: every rank of the node inserts into the same segments at once
+        {
+            ygm::container::map<map_key, int> accum(world);
+            shm_counting_set<map_key, int> cache(world, accum);
+            int flushes = 0;
+            auto flushes_ptr = world.make_ygm_ptr(flushes);
+            world.barrier();
+            start = MPI_Wtime();
+            for(const map_key &key : pairs){
+                cache.cache_insert(key, 1, flushes_ptr);
+            }
+            double insert_time = MPI_Wtime() - start;
+            world.barrier();
+            report(world, "shm_counting_set::insert", kind, ops, insert_time, 1.0 - double(flushes) / ops);
+            cache.value_cache_flush_all();
+            world.barrier();
+        }
+        world.cout0("");
+        if(sink == 42){
+            world.cout("");     // keeps the timed loops from being optimized away
+        }
+    }
+
+    // top-k recall of the heavy-hitter sketch that test_sparse uses for the hub rows, against exact counts
+    constexpr size_t top_k = 100;
+    auto comp_count = [](const std::pair<int, size_t> &lhs, const std::pair<int, size_t> &rhs){
+        if(lhs.second == rhs.second){
+            return lhs.first < rhs.first;
+        }
+        return lhs.second > rhs.second;
+    };
+    for(stream_kind kind : kinds){
+        std::vector<int> keys = make_stream(kind, ops, key_space, 2000 * uint64_t(kind) + world.rank());
+        ygm::container::counting_set<int> exact(world);
+        for(int key : keys){
+            exact.async_insert(key);
+        }
+        world.barrier();
+        std::vector<std::pair<int, size_t>> exact_top = exact.gather_topk(top_k, comp_count);
+        boost::unordered_flat_map<int, size_t> exact_keys;
+        for(const auto &[key, count] : exact_top){
+            exact_keys[key] = count;
+        }
+        for(size_t capacity : {size_t(1) << 13, size_t(1024)}){
+            space_saving<int> sketch(world, capacity);
+            double start = MPI_Wtime();
+            for(int key : keys){
+                sketch.async_insert(key);
+            }
+            double insert_time = MPI_Wtime() - start;
+            std::vector<std::pair<int, size_t>> sketch_top = sketch.gather_topk(top_k, comp_count);
+            size_t found = 0;
+            for(const auto &[key, count] : sketch_top){
+                found += exact_keys.count(key);
+            }
+            report(world, "space_saving::insert (" + std::to_string(capacity) + ")", kind, ops, insert_time);
+            world.cout0("    top ", top_k, " found: ", found, " / ", exact_top.size());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include "sorted_coo.hpp"
+#include "edge_io.hpp"
+#include <cmath>
+#include <functional>
+
+
+/*
+    Chained products (A*B*C, A^k) evaluated in one process. Intermediates stay distributed as row-sorted
+    Sorted_COO objects produced by Sorted_COO::spGemm_to_sorted(), so no step goes through file output,
+    re-parsing or a global re-sort.
+*/
+
+struct matrix_shape{
+    double rows = 0;
+    double cols = 0;
+    double nnz = 0;
+};
+
+/*
+    @brief number of rows, columns (largest index + 1) and nonzeros of a distributed Edge array
+*/
+inline matrix_shape measure_shape(ygm::comm &world, ygm::container::array<Edge> &matrix){
+    int local_max_row = -1;
+    int local_max_col = -1;
+    matrix.local_for_all([&](int index, Edge &ed){
+        local_max_row = std::max(local_max_row, ed.row);
+        local_max_col = std::max(local_max_col, ed.col);
+    });
+    matrix_shape shape;
+    shape.rows = ygm::max(local_max_row, world) + 1;
+    shape.cols = ygm::max(local_max_col, world) + 1;
+    shape.nnz = matrix.size();
+    return shape;
+}
+
+/*
+    @brief
+        estimates the shape of X*Y assuming the nonzeros are spread uniformly.
+        Each of the nnz(X) entries meets nnz(Y) / inner rows of Y on average, and the resulting
+        products fall into rows * cols cells, so some of them collide.
+
+    @param flops: set to the estimated number of scalar multiplications
+*/
+inline matrix_shape estimate_product(const matrix_shape &X, const matrix_shape &Y, double &flops){
+    double inner = std::max(1.0, std::max(X.cols, Y.rows));
+    flops = X.nnz * (Y.nnz / inner);
+    matrix_shape product;
+    product.rows = X.rows;
+    product.cols = Y.cols;
+    double cells = std::max(1.0, product.rows * product.cols);
+    product.nnz = cells * (1.0 - std::exp(-flops / cells));
+    return product;
+}
+
+/*
+    @brief
+        evaluates operands[0] * operands[1] * ... * operands[n-1], choosing the parenthesisation with the
+        smallest estimated number of multiplications (matrix-chain dynamic programming over the estimated
+        nnz of every intermediate). The input arrays are not modified. Must be called by all ranks.
+
+    @return the product as a row-sorted Sorted_COO
+*/
+inline std::unique_ptr<Sorted_COO> multiply_chain(ygm::comm &world,
+                                                  std::vector<ygm::container::array<Edge>*> operands,
+                                                  const spgemm_options &opts = {}){
+    YGM_ASSERT_RELEASE(!operands.empty());
+    int n = operands.size();
+
+    std::vector<std::vector<matrix_shape>> shape(n, std::vector<matrix_shape>(n));
+    std::vector<std::vector<double>> cost(n, std::vector<double>(n, 0.0));
+    std::vector<std::vector<int>> split(n, std::vector<int>(n, -1));
+    for(int i = 0; i < n; i++){
+        shape[i][i] = measure_shape(world, *operands[i]);
+    }
+    for(int len = 2; len <= n; len++){
+        for(int i = 0; i + len - 1 < n; i++){
+            int j = i + len - 1;
+            cost[i][j] = std::numeric_limits<double>::max();
+            for(int s = i; s < j; s++){
+                double flops = 0;
+                matrix_shape candidate = estimate_product(shape[i][s], shape[s + 1][j], flops);
+                double total = cost[i][s] + cost[s + 1][j] + flops;
+                if(total < cost[i][j]){
+                    cost[i][j] = total;
+                    shape[i][j] = candidate;
+                    split[i][j] = s;
+                }
+            }
+        }
+    }
+
+    std::function<std::string(int, int)> plan_string = [&](int i, int j) -> std::string {
+        if(i == j){
+            return "M" + std::to_string(i);
+        }
+        return "(" + plan_string(i, split[i][j]) + " * " + plan_string(split[i][j] + 1, j) + ")";
+    };
+    world.cout0("chain plan: ", plan_string(0, n - 1), ", estimated multiplications: ", cost[0][n - 1]);
+
+    // the right operand of every step has to be row-sorted; a left operand that is an input is used as is
+    std::function<std::unique_ptr<Sorted_COO>(int, int)> evaluate = [&](int i, int j) -> std::unique_ptr<Sorted_COO> {
+        if(i == j){
+            return std::make_unique<Sorted_COO>(world, copy_edge_array(world, *operands[i]), false);
+        }
+        int s = split[i][j];
+        std::unique_ptr<Sorted_COO> left;
+        ygm::container::array<Edge> *left_matrix = operands[i];
+        if(s != i){
+            left = evaluate(i, s);
+            left_matrix = &left->matrix();
+        }
+        std::unique_ptr<Sorted_COO> right = evaluate(s + 1, j);
+
+        double step_start = MPI_Wtime();
+        std::unique_ptr<Sorted_COO> product = right->spGemm_to_sorted(*left_matrix, opts);
+        double step_end = MPI_Wtime();
+        world.cout0("chain step ", plan_string(i, j), ": nnz ", product->matrix().size(),
+                    " (estimated ", size_t(shape[i][j].nnz), "), time ", step_end - step_start);
+        return product;
+    };
+    return evaluate(0, n - 1);
+}
+
+/*
+    @brief
+        computes A^k (k >= 1) by repeated squaring, so only about 2 log2(k) products are needed.
+        A is not modified. Must be called by all ranks.
+
+    @return A^k as a row-sorted Sorted_COO
+*/
+inline std::unique_ptr<Sorted_COO> matrix_power(ygm::comm &world, ygm::container::array<Edge> &A, int k,
+                                                const spgemm_options &opts = {}){
+    YGM_ASSERT_RELEASE(k >= 1);
+    auto base = std::make_unique<Sorted_COO>(world, copy_edge_array(world, A), false);
+    std::unique_ptr<Sorted_COO> result;
+    int base_power = 1;
+    int result_power = 0;
+
+    while(true){
+        if(k & 1){
+            double step_start = MPI_Wtime();
+            if(!result){
+                result = std::make_unique<Sorted_COO>(world, copy_edge_array(world, base->matrix()));
+            }
+            else{
+                result = base->spGemm_to_sorted(result->matrix(), opts);
+            }
+            result_power += base_power;
+            double step_end = MPI_Wtime();
+            world.cout0("A^", result_power, ": nnz ", result->matrix().size(), ", time ", step_end - step_start);
+        }
+        k >>= 1;
+        if(k == 0){
+            break;
+        }
+        double square_start = MPI_Wtime();
+        base = base->spGemm_to_sorted(base->matrix(), opts);
+        base_power *= 2;
+        double square_end = MPI_Wtime();
+        world.cout0("A^", base_power, ": nnz ", base->matrix().size(), ", time ", square_end - square_start);
+    }
+    return result;
+}
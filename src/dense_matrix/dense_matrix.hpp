@@ -0,0 +1,120 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/detail/ygm_ptr.hpp>
+#include <algorithm>
+#include <vector>
+
+
+/*
+    Distributed tall-skinny dense matrix (num_rows x width) for Sorted_COO::spmm() and spmv().
+
+    Rows are split into equal contiguous ranges, one per rank, and the local rows are stored contiguously
+    in row-major order, so a row is "width" consecutive values and a kernel can stream over it. A dense
+    vector is a dense_matrix with width 1.
+*/
+template <typename T>
+class dense_matrix{
+
+public:
+    using self_type = dense_matrix<T>;
+    using value_type = T;
+
+    /**
+     * @brief constructor for the dense matrix. Must be called by all ranks.
+     *
+     * @param num_rows : global number of rows
+     * @param width : number of columns
+     * @param init : initial value of every entry
+     */
+    explicit dense_matrix(ygm::comm &c, size_t num_rows, int width, T init = T()) :
+                        m_comm(c),
+                        pthis(this),
+                        m_num_rows(num_rows),
+                        m_width(width),
+                        m_rows_per_rank(std::max<size_t>(1, (num_rows + c.size() - 1) / c.size())){
+        pthis.check(m_comm);
+        m_local_start = std::min(m_num_rows, m_rows_per_rank * m_comm.rank());
+        size_t local_end = std::min(m_num_rows, m_local_start + m_rows_per_rank);
+        m_values.assign((local_end - m_local_start) * m_width, init);
+    }
+
+    int owner(size_t row) const {
+        return std::min<size_t>(row / m_rows_per_rank, m_comm.size() - 1);
+    }
+
+    bool is_local(size_t row) const {
+        return row >= m_local_start && row < m_local_start + local_rows();
+    }
+
+    /*
+        @brief first value of a row owned by this rank
+    */
+    T* local_row(size_t row) {
+        return m_values.data() + (row - m_local_start) * m_width;
+    }
+
+    const T* local_row(size_t row) const {
+        return m_values.data() + (row - m_local_start) * m_width;
+    }
+
+    /*
+        @brief calls fn(row, values) for every local row, values pointing at its "width" entries
+    */
+    template <typename Fn>
+    void local_for_all(Fn fn){
+        for(size_t i = 0; i < local_rows(); i++){
+            fn(m_local_start + i, m_values.data() + i * m_width);
+        }
+    }
+
+    void fill(T value){
+        std::fill(m_values.begin(), m_values.end(), value);
+    }
+
+    size_t num_rows() const {
+        return m_num_rows;
+    }
+
+    int width() const {
+        return m_width;
+    }
+
+    size_t local_start() const {
+        return m_local_start;
+    }
+
+    size_t local_rows() const {
+        return m_values.size() / std::max(1, m_width);
+    }
+
+    std::vector<T>& local_values() {
+        return m_values;
+    }
+
+    ygm::comm& comm() {
+        return m_comm;
+    }
+
+    typename ygm::ygm_ptr<self_type> get_ygm_ptr() const {
+        return pthis;
+    }
+
+    /*
+        @brief y[0, width) += a * x[0, width). The plain loop over restrict pointers vectorizes.
+    */
+    static void axpy(T *__restrict y, T a, const T *__restrict x, int width){
+        for(int c = 0; c < width; c++){
+            y[c] += a * x[c];
+        }
+    }
+
+private:
+    ygm::comm                                    &m_comm;
+    typename ygm::ygm_ptr<self_type>             pthis;
+    size_t                                       m_num_rows;
+    int                                          m_width;
+    size_t                                       m_rows_per_rank;
+    size_t                                       m_local_start = 0;
+    std::vector<T>                               m_values;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include "sorted_coo.hpp"
+#include <ygm/container/bag.hpp>
+#include <ygm/io/csv_parser.hpp>
+#include <string>
+
+
+/*
+    @brief
+        reads a "row,col[,value]" CSV file into a distributed Edge array (value defaults to 1),
+        the same way test_sparse.cpp reads its inputs. Must be called by all ranks.
+
+    @param filename: CSV file to read
+    @param transpose: store (col, row, value) instead of (row, col, value)
+    @param symmetrize: also store the reversed edge, for undirected graphs
+*/
+inline std::unique_ptr<ygm::container::array<Edge>> load_edge_array(ygm::comm &world, const std::string &filename,
+                                                                     bool transpose = false, bool symmetrize = false){
+    std::fstream file(filename);
+    YGM_ASSERT_RELEASE(file.is_open() == true);
+    file.close();
+
+    auto bagp = std::make_unique<ygm::container::bag<Edge>>(world);
+    ygm::io::csv_parser parser(world, std::vector<std::string>{filename});
+    parser.for_all([&](ygm::io::detail::csv_line line){
+        int row = line[0].as_integer();
+        int col = line[1].as_integer();
+        int value = 1;
+        if(line.size() == 3){
+            value = line[2].as_integer();
+        }
+        if(transpose){
+            std::swap(row, col);
+        }
+        bagp->async_insert({row, col, value});
+        if(symmetrize && row != col){
+            bagp->async_insert({col, row, value});
+        }
+    });
+    world.barrier();
+
+    auto arr = std::make_unique<ygm::container::array<Edge>>(world, *bagp);
+    bagp.reset();
+    return arr;
+}
+
+/*
+    @brief
+        copies a distributed Edge array into a new array with the same order. Must be called by all ranks.
+*/
+inline std::unique_ptr<ygm::container::array<Edge>> copy_edge_array(ygm::comm &world, ygm::container::array<Edge> &src){
+    std::vector<Edge> local_edges;
+    local_edges.reserve(src.local_size());
+    src.local_for_all([&local_edges](int index, Edge &ed){
+        local_edges.push_back(ed);
+    });
+    return build_sorted_array(world, local_edges);
+}
+
+/*
+    A CSV edge file used directly as the A operand of Sorted_COO::spGemm(): local_for_all() parses this rank's
+    part of the file and hands every Edge to the visitor as soon as it is read, so A never goes through a bag
+    or an array and the multiplication of early lines overlaps with reading later ones.
+    Every local_for_all() call reads the file again.
+*/
+class csv_edge_stream{
+
+public:
+    /**
+     * @param filename : CSV file to read, "row,col[,value]" per line
+     * @param transpose : visit (col, row, value) instead of (row, col, value)
+     * @param symmetrize : also visit the reversed edge, for undirected graphs
+     */
+    csv_edge_stream(ygm::comm &c, const std::string &filename, bool transpose = false, bool symmetrize = false) :
+                    m_comm(c), m_filename(filename), m_transpose(transpose), m_symmetrize(symmetrize){
+        std::fstream file(m_filename);
+        YGM_ASSERT_RELEASE(file.is_open() == true);
+        file.close();
+    }
+
+    /*
+        @brief calls fn(index, edge) for every edge this rank parses; index counts the local edges
+    */
+    template <typename Fn>
+    void local_for_all(Fn fn){
+        ygm::io::csv_parser parser(m_comm, std::vector<std::string>{m_filename});
+        int index = 0;
+        parser.for_all([&](ygm::io::detail::csv_line line){
+            int row = line[0].as_integer();
+            int col = line[1].as_integer();
+            int value = 1;
+            if(line.size() == 3){
+                value = line[2].as_integer();
+            }
+            if(m_transpose){
+                std::swap(row, col);
+            }
+            Edge ed = {row, col, value};
+            fn(index++, ed);
+            if(m_symmetrize && row != col){
+                Edge rev = {col, row, value};
+                fn(index++, rev);
+            }
+        });
+    }
+
+private:
+    ygm::comm                                    &m_comm;
+    std::string                                  m_filename;
+    bool                                         m_transpose;
+    bool                                         m_symmetrize;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+/*
+    Expand-sort-compress buffer for outgoing partial products.
+
+    Products are collected per destination rank as (packed key, value) pairs. When a destination's buffer
+    is full it is sorted by key and entries with equal keys are summed in place. If the reduction freed at
+    least half of the buffer, it keeps collecting (the products for this destination combine well);
+    otherwise the caller is told to send it. The caller packs the buffer into one message and clears it.
+*/
+template <typename Value>
+class esc_buffer{
+
+public:
+    using key_type = uint64_t;
+    using value_type = Value;
+    using entry_type = std::pair<key_type, value_type>;
+
+    /**
+     * @brief constructor for the expand-sort-compress buffer
+     *
+     * @param num_dest : number of destination ranks
+     * @param total_entries : number of buffered entries this rank may hold over all destinations
+     */
+    explicit esc_buffer(int num_dest, size_t total_entries) :
+                        m_buffers(num_dest),
+                        m_capacity(std::max<size_t>(min_capacity, total_entries / std::max(1, num_dest))){
+    }
+
+    /**
+     * @brief buffers one product for dest
+     *
+     * @return true if dest's buffer should be sent now
+     */
+    bool insert(int dest, key_type key, value_type value){
+        std::vector<entry_type> &buffer = m_buffers[dest];
+        if(buffer.empty()){
+            buffer.reserve(m_capacity);
+        }
+        buffer.push_back({key, value});
+        m_inserted++;
+        if(buffer.size() < m_capacity){
+            return false;
+        }
+        compress(dest);
+        return buffer.size() * 2 > m_capacity;
+    }
+
+    /**
+     * @brief sorts dest's buffer by key and sums the values of equal keys
+     */
+    void compress(int dest){
+        std::vector<entry_type> &buffer = m_buffers[dest];
+        if(buffer.size() < 2){
+            return;
+        }
+        std::sort(buffer.begin(), buffer.end(), [](const entry_type &lhs, const entry_type &rhs){
+            return lhs.first < rhs.first;
+        });
+        size_t out = 0;
+        for(size_t i = 1; i < buffer.size(); i++){
+            if(buffer[i].first == buffer[out].first){
+                buffer[out].second += buffer[i].second;
+            }
+            else{
+                buffer[++out] = buffer[i];
+            }
+        }
+        buffer.resize(out + 1);
+    }
+
+    /**
+     * @brief splits dest's (compressed) buffer into key and value arrays for sending, then empties it
+     */
+    void drain(int dest, std::vector<key_type> &keys, std::vector<value_type> &values){
+        std::vector<entry_type> &buffer = m_buffers[dest];
+        keys.resize(buffer.size());
+        values.resize(buffer.size());
+        for(size_t i = 0; i < buffer.size(); i++){
+            keys[i] = buffer[i].first;
+            values[i] = buffer[i].second;
+        }
+        m_sent += buffer.size();
+        buffer.clear();
+    }
+
+    bool empty(int dest) const {
+        return m_buffers[dest].empty();
+    }
+
+    int num_dest() const {
+        return m_buffers.size();
+    }
+
+    size_t inserted_count() const {
+        return m_inserted;
+    }
+
+    size_t sent_count() const {
+        return m_sent;
+    }
+
+    /**
+     * @brief bytes reserved by the buffers of all destinations
+     */
+    size_t local_bytes() const {
+        size_t bytes = m_buffers.capacity() * sizeof(std::vector<entry_type>);
+        for(const std::vector<entry_type> &buffer : m_buffers){
+            bytes += buffer.capacity() * sizeof(entry_type);
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t min_capacity = 64;
+
+    std::vector<std::vector<entry_type>>         m_buffers;
+    size_t                                       m_capacity;
+    size_t                                       m_inserted = 0;
+    size_t                                       m_sent = 0;
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/collective.hpp>
+#include <ygm/detail/ygm_ptr.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+
+/*
+    Distributed accumulator for the entries of C.
+
+    Drop-in replacement for ygm::container::map<map_key, Value> in Sorted_COO::spGemm(): it offers the same
+    async_visit(), for_all() and partitioner.owner() calls. Internally the (row, column) key is packed into
+    one 64-bit integer and every rank keeps its entries in an open-addressing table with linear probing.
+    Keys and values live in one memory block. When the load factor would pass 0.7 the block doubles: a new
+    one is allocated, every entry is rehashed into it and the old one is freed, so both exist during growth.
+    An entry costs 12 bytes plus the empty slots instead of a node of a general-purpose map.
+
+    Key must be an aggregate of two ints {x, y} such as map_key. Value must support +=.
+*/
+template <typename Key, typename Value>
+class flat_accumulator{
+    static_assert(std::is_trivially_copyable_v<Value>);
+
+public:
+    using self_type = flat_accumulator<Key, Value>;
+    using key_type = Key;
+    using value_type = Value;
+    using packed_type = uint64_t;
+
+    struct owner_partitioner{
+        int comm_size;
+        int rows_per_rank = 0;  // > 0 when whole rows are assigned to ranks, see partition_rows()
+
+        int owner(const Key &key) const {
+            return owner_packed(pack(key));
+        }
+
+        int owner_packed(packed_type packed) const {
+            if(rows_per_rank > 0){
+                int row = int(uint32_t(packed >> 32));
+                return std::min(row / rows_per_rank, comm_size - 1);
+            }
+            // the table slot uses the low bits of the same mix, so take the owner from the high bits
+            return (mix(packed) >> 32) % comm_size;
+        }
+    };
+
+    explicit flat_accumulator(ygm::comm &c, size_t initial_capacity = 1024) :
+                            m_comm(c),
+                            pthis(this),
+                            partitioner{c.size()}{
+        pthis.check(m_comm);
+        allocate(round_up_pow2(std::max<size_t>(initial_capacity, 16)));
+    }
+
+    /*
+        @brief
+            assigns rows [0, num_rows) to the ranks in equal contiguous ranges instead of hashing the keys,
+            so every row of C ends up complete on one rank and the ranks hold increasing row ranges.
+            Must be called by all ranks before the first insertion.
+    */
+    void partition_rows(int num_rows){
+        YGM_ASSERT_RELEASE(m_size == 0);
+        partitioner.rows_per_rank = std::max(1, (num_rows + m_comm.size() - 1) / m_comm.size());
+    }
+
+    /*
+        @brief
+            calls fn(key, value, args...) on the owner of key, with value starting at Value() for a new key.
+            Visits owned by the calling rank run immediately.
+    */
+    template <typename Fn, typename... VisitorArgs>
+    void async_visit(const Key &key, Fn fn, const VisitorArgs&... args){
+        packed_type packed = pack(key);
+        int dest = partitioner.owner_packed(packed);
+        if(dest == m_comm.rank()){
+            local_visit(key, fn, args...);
+            return;
+        }
+        auto vlambda = [fn](auto paccum, packed_type packed, const VisitorArgs&... args) mutable {
+            paccum->local_visit(unpack(packed), fn, args...);
+        };
+        m_comm.async(dest, vlambda, pthis, packed, args...);
+    }
+
+    template <typename Fn, typename... VisitorArgs>
+    void local_visit(const Key &key, Fn fn, const VisitorArgs&... args){
+        Value &value = find_or_insert(pack(key));
+        fn(key, value, args...);
+    }
+
+    /*
+        @brief adds values[i] to keys[i] (packed keys) on this rank. Every key must be owned by this rank.
+    */
+    void local_add_batch(const std::vector<packed_type> &keys, const std::vector<Value> &values){
+        reserve(m_size + keys.size());
+        for(size_t i = 0; i < keys.size(); i++){
+            find_or_insert(keys[i]) += values[i];
+        }
+    }
+
+    /*
+        @brief sends one batch of (packed key, value) additions to dest, which must own every key
+    */
+    void async_add_batch(int dest, const std::vector<packed_type> &keys, const std::vector<Value> &values){
+        auto add_batch = [](auto paccum, const std::vector<packed_type> &keys, const std::vector<Value> &values){
+            paccum->local_add_batch(keys, values);
+        };
+        m_comm.async(dest, add_batch, pthis, keys, values);
+    }
+
+    template <typename Fn>
+    void local_for_all(Fn fn){
+        for(size_t slot = 0; slot < m_capacity; slot++){
+            if(m_keys[slot] != empty_key){
+                fn(unpack(m_keys[slot]), m_values[slot]);
+            }
+        }
+    }
+
+    template <typename Fn>
+    void for_all(Fn fn){
+        m_comm.barrier();
+        local_for_all(fn);
+    }
+
+    size_t local_size() const {
+        return m_size;
+    }
+
+    size_t size(){
+        m_comm.barrier();
+        return ygm::sum(m_size, m_comm);
+    }
+
+    /*
+        @brief bytes held by this rank's table
+    */
+    size_t local_bytes() const {
+        return m_capacity * (sizeof(packed_type) + sizeof(Value));
+    }
+
+    void clear(){
+        m_comm.barrier();
+        local_clear();
+    }
+
+    void local_clear(){
+        allocate(16);
+    }
+
+    void reserve(size_t entries){
+        size_t needed = round_up_pow2(entries + entries / 2 + 1);
+        if(needed > m_capacity){
+            rehash(needed);
+        }
+    }
+
+    ygm::comm& comm(){
+        return m_comm;
+    }
+
+    static packed_type pack(const Key &key){
+        return (packed_type(uint32_t(key.x)) << 32) | uint32_t(key.y);
+    }
+
+    static Key unpack(packed_type packed){
+        return {int(uint32_t(packed >> 32)), int(uint32_t(packed))};
+    }
+
+    // murmur3 64-bit finalizer
+    static uint64_t mix(uint64_t k){
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+private:
+    static constexpr packed_type empty_key = ~packed_type(0);  // (-1, -1) is never a valid coordinate
+
+    static size_t round_up_pow2(size_t n){
+        size_t p = 1;
+        while(p < n){
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // one block holds the key array followed by the value array
+    void allocate(size_t capacity){
+        size_t key_bytes = capacity * sizeof(packed_type);
+        size_t value_offset = (key_bytes + alignof(Value) - 1) / alignof(Value) * alignof(Value);
+        m_block.reset(new std::byte[value_offset + capacity * sizeof(Value)]);
+        m_keys = reinterpret_cast<packed_type*>(m_block.get());
+        m_values = reinterpret_cast<Value*>(m_block.get() + value_offset);
+        for(size_t slot = 0; slot < capacity; slot++){
+            m_keys[slot] = empty_key;
+        }
+        m_capacity = capacity;
+        m_size = 0;
+    }
+
+    void rehash(size_t new_capacity){
+        std::unique_ptr<std::byte[]> old_block = std::move(m_block);
+        packed_type *old_keys = m_keys;
+        Value *old_values = m_values;
+        size_t old_capacity = m_capacity;
+
+        allocate(new_capacity);
+        for(size_t slot = 0; slot < old_capacity; slot++){
+            if(old_keys[slot] != empty_key){
+                find_or_insert(old_keys[slot]) = old_values[slot];
+            }
+        }
+    }
+
+    Value& find_or_insert(packed_type packed){
+        // keep the load factor below 0.7
+        if((m_size + 1) * 10 > m_capacity * 7){
+            rehash(m_capacity * 2);
+        }
+        size_t mask = m_capacity - 1;
+        size_t slot = mix(packed) & mask;
+        while(true){
+            if(m_keys[slot] == packed){
+                return m_values[slot];
+            }
+            if(m_keys[slot] == empty_key){
+                m_keys[slot] = packed;
+                m_values[slot] = Value();
+                m_size++;
+                return m_values[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    ygm::comm                                    &m_comm;
+    typename ygm::ygm_ptr<self_type>             pthis;
+    std::unique_ptr<std::byte[]>                 m_block;
+    packed_type                                  *m_keys = nullptr;
+    Value                                        *m_values = nullptr;
+    size_t                                       m_capacity = 0;
+    size_t                                       m_size = 0;
+
+public:
+    owner_partitioner                            partitioner;
+};
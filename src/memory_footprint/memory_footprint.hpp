@@ -0,0 +1,146 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/collective.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/*
+    Per-phase memory accounting.
+
+    At every phase boundary record() takes this rank's resident set size, its peak resident set size so far,
+    and the byte sizes of the data structures the caller names, and reduces each of them across ranks to
+    max and mean. Rank 0 prints one line per phase as it is recorded and a summary at the end, with the phase
+    whose resident size was highest marked. The byte sizes are what the structures hold (elements times
+    element size, or the allocated table), not what the allocator handed out; the resident size includes
+    everything.
+
+    record() is collective. When disabled it does nothing, so the calls can stay in place.
+*/
+class memory_footprint{
+
+public:
+    using component = std::pair<std::string, size_t>;
+
+    explicit memory_footprint(ygm::comm &c, bool enabled = true) : m_comm(c), m_enabled(enabled){
+    }
+
+    /*
+        @brief resident set size of this process, from /proc/self/statm. 0 where that is not available.
+    */
+    static size_t resident_bytes(){
+        std::ifstream statm("/proc/self/statm");
+        size_t total_pages = 0;
+        size_t resident_pages = 0;
+        if(!(statm >> total_pages >> resident_pages)){
+            return 0;
+        }
+        return resident_pages * size_t(sysconf(_SC_PAGESIZE));
+    }
+
+    /*
+        @brief peak resident set size of this process so far (ru_maxrss is in kilobytes on Linux)
+    */
+    static size_t peak_resident_bytes(){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return size_t(usage.ru_maxrss) * 1024;
+    }
+
+    /*
+        @brief
+            bytes ygm may hold in send buffers on this rank, from YGM_COMM_BUFFER_SIZE_KB (16 MB if unset).
+            This is the configured capacity, the buffers are only that full right before a flush.
+    */
+    static size_t configured_comm_buffer_bytes(){
+        const char *kb = std::getenv("YGM_COMM_BUFFER_SIZE_KB");
+        if(kb != nullptr){
+            return size_t(std::atoll(kb)) * 1024;
+        }
+        return size_t(16) * 1024 * 1024;
+    }
+
+    /*
+        @brief
+            records the end of "phase": resident and peak resident size plus the given (name, local bytes)
+            components, each reduced to max and mean over the ranks. Collective.
+    */
+    void record(const std::string &phase, const std::vector<component> &components = {}){
+        if(!m_enabled){
+            return;
+        }
+        std::vector<component> local = {{"rss", resident_bytes()}, {"peak rss", peak_resident_bytes()}};
+        local.insert(local.end(), components.begin(), components.end());
+
+        phase_record rec{phase, {}};
+        for(const component &comp : local){
+            size_t max_bytes = ygm::max(comp.second, m_comm);
+            size_t sum_bytes = ygm::sum(comp.second, m_comm);
+            rec.stats.push_back({comp.first, max_bytes, double(sum_bytes) / m_comm.size()});
+        }
+        m_phases.push_back(rec);
+
+        if(m_comm.rank0()){
+            std::cout << "memory after " << phase << " (max / mean MB per rank):";
+            for(size_t i = 0; i < rec.stats.size(); i++){
+                const stat &s = rec.stats[i];
+                std::cout << (i == 0 ? " " : ", ") << s.name << " " << to_mb(s.max_bytes) << " / " << to_mb(s.mean_bytes);
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    /*
+        @brief
+            prints the max and mean resident size of every recorded phase on rank 0 and marks the highest one.
+            Peak rss is cumulative, so its first large jump tells the phase that set the high-water mark.
+    */
+    void print_summary(){
+        if(!m_enabled || !m_comm.rank0() || m_phases.empty()){
+            return;
+        }
+        size_t peak_phase = 0;
+        for(size_t i = 1; i < m_phases.size(); i++){
+            if(m_phases[i].stats[0].max_bytes > m_phases[peak_phase].stats[0].max_bytes){
+                peak_phase = i;
+            }
+        }
+        std::cout << "memory summary on " << m_comm.size() << " ranks (max / mean MB per rank):" << std::endl;
+        for(size_t i = 0; i < m_phases.size(); i++){
+            const phase_record &rec = m_phases[i];
+            std::cout << "  " << rec.phase << ": rss " << to_mb(rec.stats[0].max_bytes) << " / "
+                      << to_mb(rec.stats[0].mean_bytes) << ", peak rss " << to_mb(rec.stats[1].max_bytes)
+                      << (i == peak_phase ? "  <- highest" : "") << std::endl;
+        }
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+private:
+    struct stat{
+        std::string name;
+        size_t max_bytes;
+        double mean_bytes;
+    };
+
+    struct phase_record{
+        std::string phase;
+        std::vector<stat> stats;    // rss, peak rss, then the caller's components
+    };
+
+    static double to_mb(double bytes){
+        return double(size_t(bytes / (1024.0 * 1024.0) * 10 + 0.5)) / 10;
+    }
+
+    ygm::comm                                    &m_comm;
+    bool                                         m_enabled;
+    std::vector<phase_record>                    m_phases;
+};
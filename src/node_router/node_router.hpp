@@ -0,0 +1,119 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/detail/layout.hpp>
+#include <ygm/detail/ygm_ptr.hpp>
+
+
+/*
+    Node-aggregated message routing on top of ygm::comm::async().
+
+    A message for a rank on another node takes up to three hops. It goes first to the rank of this node in
+    charge of the destination node ("relay"), then to the one rank of the destination node that receives all
+    traffic from this node ("receiver"), and finally within that node to its destination. All messages from
+    one node to another therefore cross between the nodes over a single relay -> receiver pair, so they
+    share one ygm send buffer at the relay and leave in node-sized batches. Without routing, every rank
+    holds a half-empty buffer per remote rank. Messages within the node are sent directly.
+
+    The relay of node X for node Y is the rank of X with local id Y % (ranks per node), and the receiver is
+    the rank of Y with local id X % (ranks per node). Like shm_counting_set, this assumes the ranks of a node
+    are numbered contiguously and that every node runs the same number of ranks.
+*/
+class node_router{
+
+public:
+    explicit node_router(ygm::comm &c) :
+                        m_comm(c),
+                        m_local_size(m_comm.layout().local_size()),
+                        m_node_first_rank(m_comm.rank() - m_comm.layout().local_id()),
+                        pthis(this){
+        pthis.check(m_comm);
+    }
+
+    /*
+        @brief
+            runs fn(args...) on rank "dest", through this node's relay and dest's node receiver when dest is on
+            another node.
+    */
+    template <typename Fn, typename... Args>
+    void async(int dest, Fn fn, const Args&... args){
+        if(is_node_local(dest)){
+            m_comm.async(dest, fn, args...);
+            return;
+        }
+        int relay = relay_rank(dest);
+        if(relay == m_comm.rank()){
+            send_to_node(dest, fn, args...);
+            return;
+        }
+        auto forward = [fn](auto prouter, int dest, const Args&... args){
+            prouter->m_relayed++;
+            prouter->send_to_node(dest, fn, args...);
+        };
+        m_comm.async(relay, forward, pthis, dest, args...);
+    }
+
+    /*
+        @brief number of messages this rank forwarded as a relay or a receiver
+    */
+    size_t relayed_count() const {
+        return m_relayed;
+    }
+
+    ygm::comm& comm() {
+        return m_comm;
+    }
+
+private:
+
+    bool is_node_local(int rank) const {
+        return rank >= m_node_first_rank && rank < m_node_first_rank + m_local_size;
+    }
+
+    /*
+        @brief rank of this node that forwards the traffic for dest's node, or this rank if that rank does not exist
+    */
+    int relay_rank(int dest) const {
+        int dest_node = dest / m_local_size;
+        int relay = m_node_first_rank + dest_node % m_local_size;
+        if(relay >= m_comm.size()){
+            return m_comm.rank();  // partially filled last node
+        }
+        return relay;
+    }
+
+    /*
+        @brief rank of dest's node that receives the traffic from this node, or dest if that rank does not exist
+    */
+    int receiver_rank(int dest) const {
+        int node = m_node_first_rank / m_local_size;
+        int receiver = dest - dest % m_local_size + node % m_local_size;
+        if(receiver >= m_comm.size()){
+            return dest;  // partially filled last node
+        }
+        return receiver;
+    }
+
+    /*
+        @brief sends fn(args...) from the relay to dest's node receiver, which passes it on to dest
+    */
+    template <typename Fn, typename... Args>
+    void send_to_node(int dest, Fn fn, const Args&... args){
+        int receiver = receiver_rank(dest);
+        if(receiver == dest){
+            m_comm.async(dest, fn, args...);
+            return;
+        }
+        auto deliver = [fn](auto prouter, int dest, const Args&... args){
+            prouter->m_relayed++;
+            prouter->m_comm.async(dest, fn, args...);   // within the receiver's node
+        };
+        m_comm.async(receiver, deliver, pthis, dest, args...);
+    }
+
+    ygm::comm                                          &m_comm;
+    int                                                m_local_size = -1;
+    int                                                m_node_first_rank = -1;
+    size_t                                             m_relayed = 0;
+    typename ygm::ygm_ptr<node_router>                 pthis;
+};
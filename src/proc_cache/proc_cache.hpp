@@ -3,17 +3,18 @@
 #include <ygm/comm.hpp>
 #include <ygm/container/map.hpp>
 #include <ygm/detail/ygm_ptr.hpp>
+#include <functional>
 #include <iostream>
 
 
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Container = ygm::container::map<Key, Value>>
 class proc_cache{
     static_assert(std::is_trivially_copyable_v<Key>);
     static_assert(std::is_trivially_copyable_v<Value>);
     //static constexpr size_t NUM_ENTRIES = 1000000;
 
 public:
-    using internal_container_type = ygm::container::map<Key, Value>;
+    using internal_container_type = Container;
     using key_type = Key;
     using value_type = Value;
 
@@ -30,6 +31,14 @@ public:
         m_cache.resize(cache_size, {key_type(), -1});
     }
 
+    /**
+     * @brief sends flushed entries with send(key, value) instead of the container's async_visit(), so the
+     *        caller can route them like its other messages (Sorted_COO passes its node router this way)
+     */
+    void set_sender(std::function<void(const key_type&, value_type)> send){
+        m_send = std::move(send);
+    }
+
     void cache_insert(const key_type &key, const value_type &value){
         if (m_cache_empty) {
             m_cache_empty = false;
@@ -66,13 +75,18 @@ public:
         auto key          = m_cache[slot].first;
         auto cached_value = m_cache[slot].second;
         YGM_ASSERT_DEBUG(cached_value > 0);
-        m_map.async_visit(
-            key,
-            [](const key_type &key, value_type &partial_product, value_type to_add){
-                partial_product += to_add;
-            },
-            cached_value
-        );
+        if(m_send){
+            m_send(key, value_type(cached_value));
+        }
+        else{
+            m_map.async_visit(
+                key,
+                [](const key_type &key, value_type &partial_product, value_type to_add){
+                    partial_product += to_add;
+                },
+                cached_value
+            );
+        }
         m_cache[slot].first  = key_type();
         m_cache[slot].second = -1;
         local_flush++;
@@ -93,6 +107,27 @@ public:
         }
     }
 
+    /**
+     * @brief inserts that were added to a cached entry with the same key
+     */
+    size_t hit_count() const {
+        return local_accumulate;
+    }
+
+    /**
+     * @brief inserts that pushed out a cached entry with a different key
+     */
+    size_t eviction_count() const {
+        return eviction;
+    }
+
+    /**
+     * @brief bytes held by the cache slots
+     */
+    size_t local_bytes() const {
+        return m_cache.capacity() * sizeof(m_cache[0]);
+    }
+
 
 private: 
     ygm::comm                                    &m_comm;
@@ -100,6 +135,7 @@ private:
     size_t                                       cache_size;
     bool                                         m_cache_empty = true;
     internal_container_type                      &m_map;
+    std::function<void(const key_type&, value_type)> m_send;
     int                                          local_accumulate = 0;
     int                                          local_flush = 0;
     int                                          eviction = 0;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief
+ *      stable LSD radix sort of "items" by the 64-bit unsigned key(item), one byte per pass.
+ *      The histograms of all eight bytes are taken in one pass first, and a byte that is the same for every
+ *      item is skipped, so keys with few significant bits (small row numbers in the high half of a packed
+ *      (row, col) key) cost fewer passes. Short vectors go to std::stable_sort instead.
+ *
+ * @param key: item -> uint64_t; only the key is compared, never the item itself
+ */
+template <typename T, typename KeyFn>
+void radix_sort(std::vector<T> &items, KeyFn key){
+    constexpr size_t small_size = 256;
+    constexpr int num_passes = sizeof(uint64_t);
+    size_t n = items.size();
+    if(n < small_size){
+        std::stable_sort(items.begin(), items.end(), [&key](const T &lhs, const T &rhs){
+            return key(lhs) < key(rhs);
+        });
+        return;
+    }
+
+    std::vector<std::array<size_t, 256>> counts(num_passes);
+    for(auto &count : counts){
+        count.fill(0);
+    }
+    for(const T &item : items){
+        uint64_t k = key(item);
+        for(int pass = 0; pass < num_passes; pass++){
+            counts[pass][(k >> (8 * pass)) & 0xff]++;
+        }
+    }
+
+    std::vector<T> buffer(n);
+    for(int pass = 0; pass < num_passes; pass++){
+        std::array<size_t, 256> &count = counts[pass];
+        if(*std::max_element(count.begin(), count.end()) == n){
+            continue;   // every item has the same byte here
+        }
+        size_t offset = 0;
+        for(size_t &c : count){
+            size_t bucket = c;
+            c = offset;
+            offset += bucket;
+        }
+        for(const T &item : items){
+            buffer[count[(key(item) >> (8 * pass)) & 0xff]++] = item;
+        }
+        items.swap(buffer);
+    }
+}
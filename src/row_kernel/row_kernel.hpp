@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+/*
+    Struct-of-arrays copy of a row-sorted slice: the distinct rows, where each row starts, and one column
+    and one value array. A row is a contiguous segment of cols/values, so multiplying it by a scalar is a
+    single pass over two int arrays instead of one Edge visit per element.
+*/
+class csr_slice{
+
+public:
+    /**
+     * @brief appends one entry; entries must come in (row, col) order
+     */
+    void push_back(int row, int col, int value){
+        if(m_rows.empty() || m_rows.back() != row){
+            m_rows.push_back(row);
+            m_offsets.push_back(m_cols.size());
+        }
+        m_cols.push_back(col);
+        m_values.push_back(value);
+    }
+
+    /**
+     * @brief closes the last row. Call once after the last push_back().
+     */
+    void finish(){
+        m_offsets.push_back(m_cols.size());
+        m_rows.shrink_to_fit();
+        m_offsets.shrink_to_fit();
+        m_cols.shrink_to_fit();
+        m_values.shrink_to_fit();
+    }
+
+    void clear(){
+        m_rows.clear();
+        m_offsets.clear();
+        m_cols.clear();
+        m_values.clear();
+    }
+
+    /**
+     * @brief [begin, end) positions of "row" in cols()/values(); begin == end if the slice does not hold it
+     */
+    std::pair<size_t, size_t> row_segment(int row) const {
+        auto it = std::lower_bound(m_rows.begin(), m_rows.end(), row);
+        if(it == m_rows.end() || *it != row){
+            return {0, 0};
+        }
+        size_t r = it - m_rows.begin();
+        return {m_offsets[r], m_offsets[r + 1]};
+    }
+
+    /**
+     * @brief number of distinct rows; rows()[r] spans [offsets()[r], offsets()[r + 1]) of cols()/values()
+     */
+    size_t num_rows() const {
+        return m_rows.size();
+    }
+
+    const int* rows() const {
+        return m_rows.data();
+    }
+
+    const size_t* offsets() const {
+        return m_offsets.data();
+    }
+
+    const int* cols() const {
+        return m_cols.data();
+    }
+
+    const int* values() const {
+        return m_values.data();
+    }
+
+    size_t size() const {
+        return m_cols.size();
+    }
+
+    size_t local_bytes() const {
+        return m_rows.capacity() * sizeof(int) + m_offsets.capacity() * sizeof(size_t) +
+               m_cols.capacity() * sizeof(int) + m_values.capacity() * sizeof(int);
+    }
+
+private:
+    std::vector<int>                             m_rows;
+    std::vector<size_t>                          m_offsets;  // m_rows.size() + 1 after finish()
+    std::vector<int>                             m_cols;
+    std::vector<int>                             m_values;
+};
+
+
+/**
+ * @brief
+ *      products[i] = scalar * values[i] and keys[i] = (out_row, cols[i]) packed like pack_key(), for one
+ *      row segment. The main loop has no branch and no call, so the compiler vectorizes it; zero products
+ *      are counted in the same pass and only then squeezed out.
+ *
+ * @param keys, products : room for n entries each
+ * @return number of nonzero products written to the front of keys/products
+ */
+inline size_t scale_row(const int *__restrict cols, const int *__restrict values, size_t n,
+                        int scalar, int out_row, uint64_t *__restrict keys, int *__restrict products){
+    if(scalar == 0){
+        return 0;
+    }
+    const uint64_t row_bits = uint64_t(uint32_t(out_row)) << 32;
+    size_t zeros = 0;
+    for(size_t i = 0; i < n; i++){
+        int product = scalar * values[i];   // NOTE: could overflow with large values, like the Edge loop did
+        products[i] = product;
+        keys[i] = row_bits | uint32_t(cols[i]);
+        zeros += (product == 0);
+    }
+    if(zeros == 0){
+        return n;
+    }
+    size_t out = 0;
+    for(size_t i = 0; i < n; i++){
+        keys[out] = keys[i];
+        products[out] = products[i];
+        out += (products[i] != 0);
+    }
+    return out;
+}
+
+/**
+ * @brief
+ *      scale_row() for m incoming (scalar, out_row) pairs hitting the same row segment, e.g. all A entries
+ *      of one column. The segment is read from cache after the first pair.
+ *
+ * @param keys, products : room for n * m entries each
+ * @param upper_triangle : only the columns >= out_rows[j] of the (column-sorted) segment are used for pair j
+ * @return number of nonzero products written
+ */
+inline size_t scale_row_batch(const int *cols, const int *values, size_t n,
+                              const int *scalars, const int *out_rows, size_t m,
+                              uint64_t *keys, int *products, bool upper_triangle = false){
+    size_t written = 0;
+    for(size_t j = 0; j < m; j++){
+        size_t first = upper_triangle ? std::lower_bound(cols, cols + n, out_rows[j]) - cols : 0;
+        written += scale_row(cols + first, values + first, n - first, scalars[j], out_rows[j],
+                             keys + written, products + written);
+    }
+    return written;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/collective.hpp>
+#include <ygm/detail/layout.hpp>
+#include <sys/mman.h>   // For shm_open, mmap
+#include <sys/stat.h>        /* For mode constants, fstat */
+#include <fcntl.h>           /* For O_* constants */
+#include <unistd.h>
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/*
+    Read-only view of the local slices of a distributed array, shared by all the ranks of a physical node.
+
+    Every rank copies its slice into a shared memory segment of its own, one segment per rank named after
+    the rank. Afterwards each rank maps the segments of all its node peers, so a peer's slice can be read
+    directly instead of messaging the peer. There is no node-wide segment or index: a reader picks the
+    owner's segment by rank and searches inside it. The copy does not replace the array, so while the view
+    exists every slice is in memory twice, once in the array and once in its segment.
+    Like shm_counting_set, this assumes the ranks of a node are numbered contiguously.
+    The segment names carry the pid of rank 0, so two jobs on one node never open each other's slices,
+    and any failure to create or map a segment aborts: a peer slice that is not readable would silently
+    drop its products from C.
+
+    shm only allows trivially copyable datatypes (see shm_counting_set.h).
+*/
+template <typename T>
+class shm_node_array{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    struct shm_header{
+        size_t count;
+    };
+
+public:
+    using value_type = T;
+
+    /*
+        @brief copies the given local slice into shared memory and maps the slices of the node peers.
+               Must be called by all ranks.
+
+        @param local_slice: this rank's elements
+    */
+    explicit shm_node_array(ygm::comm &c, const std::vector<T> &local_slice) :
+                            m_comm(c),
+                            m_local_size(m_comm.layout().local_size()),
+                            m_local_id(m_comm.layout().local_id()),
+                            m_node_first_rank(m_comm.rank() - m_comm.layout().local_id()),
+                            m_slices(m_local_size),
+                            m_slice_sizes(m_local_size, 0){
+
+        m_job_id = ygm::max(m_comm.rank0() ? uint64_t(getpid()) : uint64_t(0), m_comm);
+        std::string filename_s = segment_name(m_comm.rank());
+        size_t segment_size = sizeof(shm_header) + local_slice.size() * sizeof(T);
+
+        int fd = shm_open(filename_s.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if(fd == -1){
+            perror("shm_open() failed");
+        }
+        YGM_ASSERT_RELEASE(fd != -1);
+        if(ftruncate(fd, segment_size) == -1){
+            perror("ftruncate() failed");
+            close(fd);
+            shm_unlink(filename_s.c_str());
+            YGM_ASSERT_RELEASE(false);
+        }
+        void *base = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(base == MAP_FAILED){
+            perror("mapping the local slice failed");
+            shm_unlink(filename_s.c_str());
+        }
+        YGM_ASSERT_RELEASE(base != MAP_FAILED);
+        auto *header = (shm_header*)base;
+        header->count = local_slice.size();
+        if(!local_slice.empty()){
+            std::memcpy((char*)base + sizeof(shm_header), local_slice.data(), local_slice.size() * sizeof(T));
+        }
+        munmap(base, segment_size);
+
+        // every segment must exist before a peer opens it
+        m_comm.barrier();
+
+        for(int i = 0; i < m_local_size; i++){
+            map_peer(i);
+        }
+
+        // some processes may unlink before others get the chance to shm_open
+        m_comm.barrier();
+        shm_unlink(filename_s.c_str());
+    }
+
+    /*
+        @brief unmaps the slices of all node peers. The segments were unlinked by the constructor, so the
+               shared memory is returned once every rank of the node has released it; the barrier makes that
+               happen at the same point on all ranks. Must be called by all ranks; the view is empty afterwards.
+               Destroying a view that was not released unmaps it as well, without communicating.
+    */
+    void release(){
+        m_slices = std::vector<mapped_slice>(m_local_size);
+        std::fill(m_slice_sizes.begin(), m_slice_sizes.end(), 0);
+        m_comm.barrier();
+    }
+
+    /*
+        @brief true if the given global rank is on this rank's node, i.e. its slice can be read directly
+    */
+    bool is_node_local(int rank) const {
+        return rank >= m_node_first_rank && rank < m_node_first_rank + m_local_size;
+    }
+
+    /*
+        @brief first element of the slice of a node-local rank
+    */
+    const T* slice_begin(int rank) const {
+        return m_slices.at(rank - m_node_first_rank).data;
+    }
+
+    const T* slice_end(int rank) const {
+        return slice_begin(rank) + m_slice_sizes.at(rank - m_node_first_rank);
+    }
+
+    /*
+        @brief total bytes of all the node's slices (shared once per node)
+    */
+    size_t node_bytes() const {
+        size_t total = 0;
+        for(size_t count : m_slice_sizes){
+            total += count * sizeof(T);
+        }
+        return total;
+    }
+
+private:
+
+    struct mapped_slice{
+        void *base = MAP_FAILED;
+        size_t size = 0;
+        const T *data = nullptr;
+
+        mapped_slice() = default;
+        mapped_slice(const mapped_slice&) = delete;
+        mapped_slice& operator=(const mapped_slice&) = delete;
+        ~mapped_slice(){
+            if(base != MAP_FAILED){
+                munmap(base, size);
+            }
+        }
+    };
+
+    std::string segment_name(int rank) const {
+        return "/SORTED_SLICE_" + std::to_string(m_job_id) + "_" + std::to_string(rank);
+    }
+
+    void map_peer(int local_id){
+        std::string filename = segment_name(m_node_first_rank + local_id);
+        int fd = shm_open(filename.c_str(), O_RDONLY, 0666);
+        if (fd == -1) {
+            perror("Opening a peer slice failed");
+        }
+        YGM_ASSERT_RELEASE(fd != -1);
+        struct stat st;
+        int stat_result = fstat(fd, &st);
+        if(stat_result == -1){
+            perror("fstat() on a peer slice failed");
+            close(fd);
+        }
+        YGM_ASSERT_RELEASE(stat_result != -1 && size_t(st.st_size) >= sizeof(shm_header));
+        void *mmap_ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mmap_ptr == MAP_FAILED){
+            perror("mapping a peer slice failed");
+        }
+        YGM_ASSERT_RELEASE(mmap_ptr != MAP_FAILED);
+
+        mapped_slice &slice = m_slices.at(local_id);
+        slice.base = mmap_ptr;
+        slice.size = st.st_size;
+        slice.data = (const T*)((const char*)mmap_ptr + sizeof(shm_header));
+        m_slice_sizes.at(local_id) = ((const shm_header*)mmap_ptr)->count;
+    }
+
+    ygm::comm                                          &m_comm;
+    int                                                m_local_size = -1;
+    int                                                m_local_id = -1;
+    int                                                m_node_first_rank = -1;
+    uint64_t                                           m_job_id = 0;         // pid of rank 0, part of the segment names
+    std::vector<mapped_slice>                          m_slices;
+    std::vector<size_t>                                m_slice_sizes;
+};
@@ -1,6 +1,16 @@
 #pragma once
 #include "proc_cache/proc_cache.hpp"
+#include "shm_node_array/shm_node_array.h"
+#include "node_router/node_router.hpp"
+#include "esc_buffer/esc_buffer.hpp"
+#include "flat_accumulator/flat_accumulator.hpp"
+#include "wire_codec/wire_codec.hpp"
+#include "dense_matrix/dense_matrix.hpp"
+#include "memory_footprint/memory_footprint.hpp"
+#include "row_kernel/row_kernel.hpp"
+#include "radix_sort/radix_sort.hpp"
 #include <ygm/comm.hpp>
+#include <ygm/collective.hpp>
 #include <ygm/container/map.hpp>
 #include <ygm/container/array.hpp>
 #include <ygm/container/set.hpp>
@@ -9,10 +19,19 @@
 #include <boost/unordered/unordered_flat_map.hpp>
 #include <ygm/container/detail/block_partitioner.hpp> // for local_start() and local_end()
 #include <fstream>
+#include <string>
+#include <cstdint>
+#include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 #include <cassert>
+#include <limits>
+#include <memory>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <numeric>
 
 struct map_key{
     int x;
@@ -40,6 +59,17 @@ std::size_t hash_value(map_key const& key) {
   return seed;
 }
 
+/*
+    packs (row, column) into one 64-bit integer that sorts in row-major order for non-negative indices
+*/
+inline uint64_t pack_key(const map_key &key) {
+    return (uint64_t(uint32_t(key.x)) << 32) | uint32_t(key.y);
+}
+
+inline map_key unpack_key(uint64_t packed) {
+    return {int(uint32_t(packed >> 32)), int(uint32_t(packed))};
+}
+
 struct Edge{
     int row;
     int col;
@@ -57,6 +87,111 @@ struct Edge{
     }
 };
 
+/*
+    Runtime knobs for Sorted_COO::spGemm(). The defaults reproduce the original
+    one-thread-per-rank behaviour.
+*/
+struct spgemm_options{
+    // threads per rank used to multiply incoming A entries against the local slice of B.
+    // 1 keeps the single-threaded path, 0 picks hardware threads / ranks per node.
+    int num_threads = 1;
+    // number of A entries packed into one message to a row owner in the threaded path
+    size_t batch_size = 4096;
+    // relay row visits and C updates bound for another node through one rank of this node and one rank of the
+    // destination node, so the traffic between two nodes is batched together (see node_router)
+    bool two_hop_routing = false;
+    // entries per rank buffered by the expand-sort-compress stage, which combines outgoing products
+    // with equal (row, col) before sending them to C as one batch per owner. 0 disables it.
+    size_t esc_buffer_entries = 0;
+    // send the batched messages (threaded row batches, expand-sort-compress batches) delta/varint packed
+    // by wire_codec instead of as raw ints
+    bool compress_messages = false;
+    // only generate and store the entries of C with row <= col. Valid when C is symmetric, e.g. B = A^T
+    // (C = A * A^T) or B = A for an undirected A; the entries below the diagonal are the mirrored ones.
+    bool upper_triangle = false;
+    // per-rank memory for the products of one pass. When set, A is multiplied in row batches sized so the
+    // estimated products of a batch fit this budget (see spGemm_batched()). 0 runs all of A at once.
+    size_t memory_budget = 0;
+    // with memory_budget set: after each batch, the finished C rows are appended to "<spill_prefix>.<rank>.spill"
+    // and removed from the accumulator. Empty keeps C in memory.
+    std::string spill_prefix;
+    // with memory_budget set: print the timing and message statistics of every batch instead of one summary
+    bool print_batch_stats = false;
+    // if set, spGemm() records the footprint of B, C, the cache and the message buffers when the multiply ends
+    memory_footprint *memory = nullptr;
+};
+
+/*
+    Which entries of C Sorted_COO::spGemm_pruned() keeps. The filters apply in this order; the defaults keep
+    every entry.
+*/
+struct prune_options{
+    // keep the row_top_k entries of each row with the largest values (ties go to the smaller column). 0 keeps all.
+    size_t row_top_k = 0;
+    // drop entries whose absolute value is below this
+    int64_t min_abs_value = 0;
+    // keep at most this many entries of C in total, those with the largest absolute values. 0 is no limit.
+    size_t max_nnz = 0;
+};
+
+/*
+    How Sorted_COO::similarity() turns the common-neighbour sum of a vertex pair (i, j) into its score,
+    with d(v) the degree of v:
+        common_neighbours   sum over shared neighbours w of A[i][w] * A[j][w]
+        jaccard             common / (d(i) + d(j) - common)
+        cosine              common / sqrt(d(i) * d(j))
+        adamic_adar         sum over shared neighbours w of 1 / log(d(w)), neighbours of degree 1 add nothing
+*/
+enum class similarity_measure{ common_neighbours, jaccard, cosine, adamic_adar };
+
+struct scored_pair{
+    int row;
+    int col;
+    double score;
+};
+
+/*
+    Per-graph settings picked by Sorted_COO::tune() and stored by save_tuned_config(). The defaults are what
+    test_sparse.cpp runs with when no tuned file is loaded.
+*/
+struct tuned_config{
+    size_t top_k = 100;                     // top rows x top cols pairs cached by proc_cache (k * k slots)
+    size_t num_hubs = 100;                  // rows of B passed to replicate_hub_rows()
+    size_t batch_size = 4096;               // spgemm_options::batch_size
+    size_t esc_buffer_entries = 1 << 20;    // spgemm_options::esc_buffer_entries, 0 if combining does not pay
+};
+
+/*
+    The entries of a matrix whose row lies in [begin_row, end_row), for one batch of spGemm_batched().
+*/
+template <class Matrix>
+struct row_range_view{
+    Matrix &matrix;
+    int begin_row;
+    int end_row;
+
+    template <typename Fn>
+    void local_for_all(Fn fn){
+        matrix.local_for_all([&](int index, Edge &ed){
+            if(ed.row >= begin_row && ed.row < end_row){
+                fn(index, ed);
+            }
+        });
+    }
+};
+
+/*
+    @brief
+        sorts a distributed Edge array in place by (row, col), replacing ygm's generic sort() for Edges.
+        Every rank radix-sorts its elements on the packed (row, col) key, sends regular samples of the keys
+        to rank 0 and gets back size - 1 splitters. A splitter is moved to the start of its row unless that
+        row alone holds more than one rank's share of the samples, so only oversized rows are cut between
+        buckets. The buckets are exchanged in batches, radix-sorted again and written back in order.
+        Values are never compared: entries with equal (row, col) keep no particular order.
+        Must be called by all ranks.
+*/
+void sort_edges(ygm::comm &c, ygm::container::array<Edge> &arr);
+
 
 class Sorted_COO{
 
@@ -71,62 +206,104 @@ public:
     explicit Sorted_COO(ygm::comm& c, ygm::container::array<Edge>& src,
                         size_t top_k,
                         std::vector<std::pair<int, size_t>> top_rows, 
-                        std::vector<std::pair<int, size_t>> top_cols): m_comm(c), sorted_matrix(src), pthis(this), top_k(top_k)
+                        std::vector<std::pair<int, size_t>> top_cols,
+                        bool is_sorted = false): m_comm(c), sorted_matrix(src), pthis(this), top_k(top_k)
                         
     {
         pthis.check(m_comm);
         row_owners.resize(m_comm.size());
 
-        for(int i = 0; i < top_k; i++){
-            for(int j = 0; j < top_k; j++){
-                top_pairs.insert({top_rows[i].first, top_cols[j].first});
-            }
+        set_top_pairs(top_k, top_rows, top_cols);
+        if(!is_sorted){
+            double sort_start = MPI_Wtime();
+            sort_edges(m_comm, sorted_matrix);
+            double sort_end = MPI_Wtime();
+            m_comm.cout0("edge array sort time: ", sort_end - sort_start);
         }
-        double sort_start = MPI_Wtime();
-        sorted_matrix.sort();
-        double sort_end = MPI_Wtime();
-        m_comm.cout0("ygm array sort time: ", sort_end - sort_start);
         
-        double map_start = MPI_Wtime();
-
-        m_comm.barrier(); 
-        double map_end = MPI_Wtime();
-        m_comm.cout0("row-owner map initialization time: ", map_end - map_start);
-
-        double merge_start = MPI_Wtime();
-        auto populate_row_owners = [](std::pair<int, int> min_max, int rank, auto self){
-            self->row_owners[rank] = min_max;
-        };
-
-        int first = sorted_matrix.local_cbegin().operator*().value.row;
-        int last = -1;
-        auto curr = sorted_matrix.local_cbegin();
-        for(;curr != sorted_matrix.local_cend(); curr.operator++()){
-            last = curr.operator*().value.row;
-        }
+        build_row_owners();
+    }
 
-        m_comm.async(0, populate_row_owners, 
-                    std::make_pair(first, last), 
-                    m_comm.rank(), pthis);
-        m_comm.barrier();
-        double merge_end = MPI_Wtime();
-        m_comm.cout0("merge row-owner data time: ", merge_end - merge_start);
-
-        double bc_start = MPI_Wtime();
-        auto broadcast_owners = [](std::vector<std::pair<int, int>> owners, auto self){
-            self->row_owners = owners;
-        };
-        if(m_comm.rank0()){
-            m_comm.async_bcast(broadcast_owners, row_owners, pthis);
-        }
-        m_comm.barrier();
-        double bc_end = MPI_Wtime();
-        m_comm.cout0("broadcast row-owner data time: ", bc_end - bc_start);
+    /*
+        @brief
+            builds a Sorted_COO that owns its array, e.g. the output of spGemm_to_sorted().
+            When the array is already sorted globally the sort is skipped and only the row-owner table is built.
 
+        @param matrix: array kept alive by the new object
+        @param is_sorted: false if the array still has to be sorted
+    */
+    explicit Sorted_COO(ygm::comm& c, std::unique_ptr<ygm::container::array<Edge>> matrix, bool is_sorted = true):
+                        m_comm(c), owned_matrix(std::move(matrix)), sorted_matrix(*owned_matrix), pthis(this), top_k(0)
+    {
+        pthis.check(m_comm);
+        row_owners.resize(m_comm.size());
+        if(!is_sorted){
+            double sort_start = MPI_Wtime();
+            sort_edges(m_comm, sorted_matrix);
+            double sort_end = MPI_Wtime();
+            m_comm.cout0("edge array sort time: ", sort_end - sort_start);
+        }
+        build_row_owners();
     }
 
     void print_row_owners();
 
+    /*
+        @brief
+            makes the pairs of the first k top rows and the first k top columns the keys that spGemm() sends
+            to its proc_cache (when compiled with CACHE). Local, no communication.
+    */
+    void set_top_pairs(size_t k, const std::vector<std::pair<int, size_t>> &top_rows,
+                       const std::vector<std::pair<int, size_t>> &top_cols);
+
+    /*
+        @brief
+            picks a tuned_config for multiplying matrix_A by this matrix from samples instead of full runs.
+            Every rank multiplies up to samples_per_rank of its A entries by their B rows without sending
+            any products. On that slice of the product stream the B owners replay the top-pair cache for
+            candidate k (hits save a message to C) and count repeated (row, col) keys (what expand-sort-compress
+            can combine). The sampled A entries also tell how many visits each candidate hub-row count would
+            keep local, against the bytes it replicates. Results are scaled by the sampling stride, printed
+            per candidate on rank 0, and turned into the returned config. Must be called by all ranks.
+
+        @param top_rows, top_cols: as gathered for the constructor, with at least as many entries as the
+                                   largest top_k candidate worth trying
+    */
+    template <class Matrix>
+    tuned_config tune(Matrix &matrix_A, const std::vector<std::pair<int, size_t>> &top_rows,
+                      const std::vector<std::pair<int, size_t>> &top_cols, size_t samples_per_rank = 1 << 14);
+
+    /*
+        @brief
+            bytes this rank holds for the matrix: its slice of the sorted array and its struct-of-arrays copy,
+            the row-owner and owner tables, replicated hub rows and the inboxes of the threaded multiply.
+            Local, no communication.
+    */
+    size_t local_bytes() const;
+
+    /*
+        @brief the globally row-sorted array this object multiplies with
+    */
+    ygm::container::array<Edge>& matrix() { return sorted_matrix; }
+
+    /*
+        @brief
+            finds the num_hubs rows of the sorted matrix with the most nonzeros and copies them to every rank.
+            spGemm() multiplies A entries that hit a hub row locally instead of messaging the row owners.
+            Must be called by all ranks.
+
+        @param num_hubs: number of highest-degree rows to replicate. 0 removes any replicated rows.
+    */
+    void replicate_hub_rows(size_t num_hubs);
+
+    /*
+        @brief
+            copies the local slice of the sorted matrix into shared memory and maps the slices of the other
+            ranks on the same node. spGemm() then multiplies A entries whose B row lives on this node by reading
+            the peer's slice directly; only rows owned by other nodes are messaged. Must be called by all ranks.
+    */
+    void share_node_slices();
+
     /*
         @brief 
             gets the owners of the row number that matches to the given argument "source".
@@ -135,6 +312,22 @@ public:
     */
     std::vector<int> get_owners(int source);
 
+    /*
+        @brief
+            owners of "row" as the rank range [first, last) without allocating; empty when no rank holds the row.
+            A sorted slice splits a row over consecutive ranks only, so the owners are always a range.
+            The last lookup is cached, so consecutive A entries with the same column do not search again.
+            Not thread-safe because of that cache.
+    */
+    std::pair<int, int> owner_range(int row);
+
+    /*
+        @brief
+            precomputes the first owner of every row (4 bytes per row of B on every rank) so owner_range()
+            is a table lookup instead of a binary search over the ranks. Local, no communication.
+    */
+    void build_owner_table();
+
    
     /**
         @brief
@@ -163,24 +356,478 @@ public:
             in the Accumulator class, which is a ygm::container::map for now.
             This function calls async_visit_row();
 
+            Calls merge_delta() first, which rewrites matrix() in place after an spGemm_update().
+
         @param Matrix matrix_A: unsorted matrix that starts the sparse multiplication. Traverses column-by-column.
         @param Accumulator C: distributed map that stores the partial products
     */
     template <class Matrix, class Accumulator>
-    void spGemm(Matrix &matrix_A, Accumulator &partial_accum);
+    void spGemm(Matrix &matrix_A, Accumulator &partial_accum, const spgemm_options &opts = {});
+
+    /*
+        @brief
+            spGemm() in passes over row ranges of A, so only the products of one range are in flight and in C
+            at a time. The number of passes comes from opts.memory_budget and the estimated number of products
+            (nnz(A) * average B row length); the ranges hold equal shares of A's nonzeros. A pass produces
+            complete C rows, so with opts.spill_prefix set they are written to local disk and C is cleared
+            before the next pass. Called by spGemm() when opts.memory_budget > 0.
+    */
+    template <class Matrix, class Accumulator>
+    void spGemm_batched(Matrix &matrix_A, Accumulator &partial_accum, const spgemm_options &opts);
+
+    /*
+        @brief
+            multiplies like spGemm(), but accumulates each row of C on the rank owning that row's range
+            and returns C directly as a new row-sorted Sorted_COO (row-owner table included), so it can be
+            the next operand of a chained product without a bag copy and a global sort.
+
+        @param Matrix matrix_A: unsorted matrix that starts the sparse multiplication.
+        @return the product matrix_A * (this matrix)
+    */
+    template <class Matrix>
+    std::unique_ptr<Sorted_COO> spGemm_to_sorted(Matrix &matrix_A, const spgemm_options &opts = {});
+
+    /*
+        @brief
+            spGemm_to_sorted() that returns only the entries of C selected by "prune". After accumulation every
+            row of C is complete on one rank, so the per-row filters run there before C is built; the global
+            budget is met with one absolute-value threshold shared by all ranks. Must be called by all ranks.
+    */
+    template <class Matrix>
+    std::unique_ptr<Sorted_COO> spGemm_pruned(Matrix &matrix_A, const prune_options &prune,
+                                              const spgemm_options &opts = {});
+
+    /*
+        @brief
+            pairwise vertex similarity in one pass, this matrix being B = A^T. Every A entry (i, w) visits the
+            owners of row w like in spGemm(), which pair it with each j of that row (j != i) and add the
+            weighted product to (i, j) on the rank owning row i of the result. No C is built or written: each
+            rank normalizes its accumulated pairs right away with the degrees of i and j. Must be called by all ranks.
+
+        @param Matrix matrix_A: the graph, one entry per (vertex, neighbour); symmetric for undirected graphs
+        @param degrees: width 1, a row for every vertex; the row degrees of A, e.g. counted while reading it
+        @return this rank's pairs with a nonzero common-neighbour sum, sorted by (row, col). Rank r holds rows
+                below those of rank r + 1.
+    */
+    template <class Matrix>
+    std::vector<scored_pair> similarity(Matrix &matrix_A, dense_matrix<double> &degrees, similarity_measure measure);
+
+    /*
+        @brief
+            queues new entries of this matrix for the next spGemm_update(). Each entry is sent to the rank
+            delta_owner(row), which keeps its pending entries sorted. Duplicates of existing (row, col)
+            entries add to them. Rows and columns must be non-negative. Must be called by all ranks.
+    */
+    void add_delta(const std::vector<Edge> &local_edges);
+
+    /*
+        @brief
+            adds the product terms of the pending entries of both operands to C, which must hold A * B for the
+            operands without them: C += dA * (B + dB) + A * dB, i.e. dA * B + A * dB + dA * dB.
+            An entry (i, w) of dA visits the owners of row w of B and the side buffer of w; an entry (w, j) of
+            dB visits row w of A^T the same way. The work and the messages grow with the pending entries and
+            the rows they touch, not with nnz(A) or nnz(B). Afterwards the pending entries move to the sorted
+            side buffers of the operands, which are merged into the arrays once they reach 1/16 of them
+            (see merge_delta()). Must be called by all ranks.
+
+        @param transposed_A: A^T as a Sorted_COO, with dA^T queued by add_delta(). May be this object when
+                             B = A^T (C = A * A^T, or A * A for a symmetric A); its pending entries are then
+                             dB and dA^T at once.
+        @param Accumulator C: the accumulator spGemm() filled. opts.upper_triangle must match that run.
+    */
+    template <class Accumulator>
+    void spGemm_update(Sorted_COO &transposed_A, Accumulator &partial_accum, const spgemm_options &opts = {});
+
+    /*
+        @brief
+            folds the side buffer of entries applied by spGemm_update() into the sorted array: the array is
+            resized, refilled, sorted with sort_edges() and the row owners, owner table and hub rows are
+            rebuilt. Shared node slices have to be set up again. Pending entries stay pending. spGemm() and the
+            other products call it first; it returns at once when the side buffer is empty. Must be called by all ranks.
+
+            The sorted array is the caller's: the array passed to the constructor (matrix()) is rewritten in
+            place, with resize() and write_edge_runs(). spGemm_update() (once the side buffer reaches
+            1/16 of the array) and every spGemm(), spmm(), spmv(), spmm_transpose(), similarity(), transpose(),
+            tune() or save_snapshot() after it can therefore change its size and contents.
+    */
+    void merge_delta();
+
+    /*
+        @brief
+            returns the transpose of this matrix as a new row-sorted Sorted_COO, see transpose_edges().
+
+        @param row_degrees: if not null, receives (row, nonzeros) of the transposed rows held by this rank
+    */
+    std::unique_ptr<Sorted_COO> transpose(std::vector<std::pair<int, size_t>> *row_degrees = nullptr);
+
+    /*
+        @brief
+            writes this matrix to per-rank files "<prefix>.<rank>.edges" (see save_edge_snapshot()) and its
+            row-owner table, top-k pairs, hub row count and whether the owner table is built to "<prefix>.meta".
+            The hub rows and the owner table themselves are not written: load_snapshot() rebuilds them.
+            Must be called by all ranks.
+    */
+    void save_snapshot(const std::string &prefix);
+
+    /*
+        @brief
+            rebuilds a Sorted_COO written by save_snapshot(), without parsing or sorting. With the rank count of
+            the run that saved it, every rank reads back its own slice and the saved row-owner table is reused;
+            otherwise the files are spread over the new ranks and the table is rebuilt. If the saved matrix had
+            replicated hub rows or an owner table, they are rebuilt with replicate_hub_rows() and build_owner_table()
+            (the same rows, since B is the same). Node slices and spGemm() state are not restored.
+            Must be called by all ranks.
+    */
+    static std::unique_ptr<Sorted_COO> load_snapshot(ygm::comm &c, const std::string &prefix);
+
+    /*
+        @brief
+            Y = B * X, B being this matrix. Every rank fetches the X rows matching the distinct columns of its
+            slice from their owners in one batched round, multiplies its rows locally and adds the results
+            to Y on Y's owners (a row split over two slices is summed there). Must be called by all ranks.
+            Calls merge_delta() first, which rewrites matrix() in place after an spGemm_update().
+
+        @param X: needs a row for every column of B
+        @param Y: needs a row for every row of B and the width of X. Overwritten, must not be X.
+    */
+    template <typename T>
+    void spmm(dense_matrix<T> &X, dense_matrix<T> &Y);
+
+    /*
+        @brief y = B * x for dense vectors (width 1 dense_matrix), see spmm(); merges the delta like it
+    */
+    template <typename T>
+    void spmv(dense_matrix<T> &x, dense_matrix<T> &y);
+
+    /*
+        @brief
+            Y = B^T * X. Each X row i is sent to get_owners(i), like an A entry in spGemm(); the owners scale it
+            by the entries of their part of row i and add the results to Y rows B.col. Must be called by all ranks.
+            Calls merge_delta() first, which rewrites matrix() in place after an spGemm_update().
+
+        @param X: needs a row for every row of B
+        @param Y: needs a row for every column of B and the width of X. Overwritten, must not be X.
+    */
+    template <typename T>
+    void spmm_transpose(dense_matrix<T> &X, dense_matrix<T> &Y);
 
 
 private:
+    /*
+        @brief used by load_snapshot() when the saved row-owner table still matches the partitioning
+    */
+    Sorted_COO(ygm::comm& c, std::unique_ptr<ygm::container::array<Edge>> matrix,
+               std::vector<std::pair<int, int>> owners):
+               m_comm(c), owned_matrix(std::move(matrix)), sorted_matrix(*owned_matrix), pthis(this), top_k(0),
+               row_owners(std::move(owners))
+    {
+        pthis.check(m_comm);
+        build_local_rows();
+    }
+
+
+    /*
+        @brief
+            gathers the first and last local row of every rank on rank 0 and broadcasts the table,
+            then builds the struct-of-arrays copy of the local slice.
+    */
+    void build_row_owners();
+
+    /*
+        @brief
+            copies the local slice into local_rows (column and value arrays, one segment per row), which the
+            multiply kernels read instead of visiting the array one Edge at a time. Local, no communication.
+    */
+    void build_local_rows();
+
+    /*
+        @brief
+            multiplies like spGemm() into an accumulator that gives every row of C to one rank, and returns
+            this rank's rows of C sorted by (row, col). Rank r holds rows below those of rank r + 1.
+    */
+    template <class Matrix>
+    std::vector<Edge> row_owned_product(Matrix &matrix_A, const spgemm_options &opts);
+
+    /*
+        @brief applies "prune" to this rank's complete rows of C, sorted by (row, col). Collective.
+    */
+    void prune_rows(std::vector<Edge> &rows, const prune_options &prune);
+
+    /*
+        @brief the rank keeping the side-buffer and pending entries of "row"
+    */
+    int delta_owner(int row) const;
+
+    /*
+        @brief
+            merges the pending entries into the side buffer after spGemm_update() has used them. Collective.
+    */
+    void apply_pending_delta();
+
+    /*
+        @brief
+            the global top "count" rows of the sorted matrix by nonzeros, as (row, nonzeros) sorted by
+            decreasing count, on every rank. Collective.
+    */
+    std::vector<std::pair<int, size_t>> top_row_degrees(size_t count);
+
+    /*
+        @brief
+            returns the Edges of "row" held by owner_rank, read from its node-shared slice.
+            owner_rank must be on this rank's node and share_node_slices() must have been called.
+    */
+    std::pair<const Edge*, const Edge*> node_row_range(int owner_rank, int row) const;
+
+    /*
+        @brief
+            with upper_triangle set, skips the Edges of a column-sorted row range whose column is below out_row,
+            so they produce no entry of C under the diagonal. Returns begin otherwise.
+    */
+    const Edge* first_product_edge(const Edge *begin, const Edge *end, int out_row) const;
+
+    /*
+        @brief sends fn(args...) to dest, through the node router when two-hop routing is on
+    */
+    template <typename Fn, typename... Args>
+    void route(int dest, Fn fn, const Args&... args);
+
+    /*
+        @brief
+            async_visit() on the accumulator. With two-hop routing on, the visit is routed to the owner of
+            the key first, where the accumulator's own async_visit() stays local.
+    */
+    template <typename AccumPtr, typename Fn, typename... Args>
+    void visit_accumulator(AccumPtr pmap, const map_key &key, Fn fn, const Args&... args);
+
+    /*
+        @brief
+            buffers one partial product in the expand-sort-compress stage, sending the owner's batch
+            once it no longer combines well.
+    */
+    template <typename AccumPtr>
+    void esc_insert(AccumPtr pmap, const map_key &key, int product);
+
+    /*
+        @brief sends the buffered products for one owner of C as a single message
+    */
+    template <typename AccumPtr>
+    void esc_send(AccumPtr pmap, int dest);
+
+    /*
+        @brief compresses and sends every non-empty buffer. Needs a barrier afterwards.
+    */
+    template <typename AccumPtr>
+    void esc_flush_all(AccumPtr pmap);
+
+    /*
+        @brief
+            hybrid MPI + threads version of spGemm(). A entries are shipped to the row owners in batches,
+            then a pool of threads multiplies the received entries against the shared, read-only local
+            slice of B. Each thread accumulates into its own map; the maps are merged and sent to C at the end.
+    */
+    template <class Matrix, class Accumulator>
+    void spGemm_threaded(Matrix &matrix_A, Accumulator &partial_accum, const spgemm_options &opts);
+
+    /*
+        @brief
+            the multiplication of spGemm() after its setup: the single-threaded loop, or spGemm_threaded().
+            Never batches, so spGemm_batched() can run it on a row_range_view without instantiating
+            spGemm_batched() again for the view.
+    */
+    template <class Matrix, class Accumulator>
+    void spGemm_impl(Matrix &matrix_A, Accumulator &partial_accum, const spgemm_options &opts);
+
+    /*
+        @brief this rank's slice of the sorted matrix as a vector, in order
+    */
+    std::vector<Edge> local_slice();
+
+    /*
+        @brief
+            adds rows[i] += values[i * width, (i + 1) * width) on the owners of the rows of Y,
+            one message per owner and batch. Needs a barrier afterwards.
+    */
+    template <typename T>
+    void add_dense_rows(dense_matrix<T> &Y, const std::vector<int> &rows, const std::vector<T> &values);
+
+    /*
+        @brief
+            fetches the X rows listed in "rows" (sorted, no duplicates) from their owners, one message per owner
+            and batch, and returns them packed in that order, width values per row. Collective.
+    */
+    template <typename T>
+    std::vector<T> gather_dense_rows(dense_matrix<T> &X, const std::vector<int> &rows);
+
+    /*
+        @brief
+            packs a batch of A entries for a row owner: sorted by (row, col), then encoded by wire_codec
+    */
+    std::vector<uint8_t> encode_edges(std::vector<Edge> &batch);
+
+    /*
+        @brief appends the A entries of an encode_edges() batch to row_inbox
+    */
+    void decode_edges(const std::vector<uint8_t> &bytes);
+
+    /*
+        @brief prints the bytes saved by wire_codec over the whole job. Collective.
+    */
+    void print_wire_stats();
+
+    /*
+        @brief prints how many products the expand-sort-compress stage combined since spGemm() started. Collective.
+    */
+    void print_esc_stats();
+
+    /*
+        @brief records the "multiply" phase in opts.memory, if set and the pass prints its statistics. Collective.
+
+        @param cache_bytes: bytes of the top-pair cache used by the multiply, 0 if none
+    */
+    template <class Matrix, class Accumulator>
+    void record_multiply_memory(const spgemm_options &opts, Matrix &matrix_A, Accumulator &partial_accum,
+                                size_t cache_bytes);
+
     ygm::comm &m_comm;                            // store the communicator. Hence the &
+    std::unique_ptr<ygm::container::array<Edge>> owned_matrix;   // only set when this object owns its array
     ygm::container::array<Edge> &sorted_matrix;
     typename ygm::ygm_ptr<Sorted_COO> pthis;
     size_t top_k;
     boost::unordered_flat_set<std::pair<int, int>> top_pairs;
 
     std::vector<std::pair<int, int>> row_owners;
+    std::vector<int> owner_table;                 // first owner of every row, set by build_owner_table(); -1 if none
+    csr_slice local_rows;                         // struct-of-arrays copy of the local slice, see build_local_rows()
+    int cached_row = std::numeric_limits<int>::min();   // last owner_range() lookup
+    std::pair<int, int> cached_range = {0, 0};
+    std::vector<Edge> row_inbox;                  // A entries received for local rows (threaded spGemm)
+    std::vector<std::pair<int, Edge>> node_inbox; // (owner rank, A entry) for rows held by node peers (threaded spGemm)
+
+    // replicated copies of the highest-degree rows: row -> its Edges
+    boost::unordered_flat_map<int, std::vector<Edge>> hub_rows;
+    boost::unordered_flat_map<int, size_t> hub_candidates;   // rank 0 only, while top_row_degrees() runs
+
+    std::unique_ptr<shm_node_array<Edge>> node_slices;      // set by share_node_slices()
+    std::unique_ptr<node_router> router;                    // set by spGemm() when two_hop_routing is on
+    std::unique_ptr<esc_buffer<int>> esc;                   // set by spGemm() when esc_buffer_entries > 0
+    bool compress_messages = false;                         // copied from spgemm_options by spGemm()
+    bool upper_triangle = false;                            // copied from spgemm_options by spGemm()
+    bool pass_stats = true;                                 // false while spGemm_batched() keeps its passes quiet
+
+    // entries added after the array was sorted, for rows with delta_owner(row) == rank, sorted by (row, col)
+    std::vector<Edge> pending_delta;                        // queued by add_delta(), not yet in C
+    csr_slice pending_rows;                                 // pending_delta as row segments
+    std::vector<Edge> delta_edges;                          // side buffer: in C, not yet in the array
+    csr_slice delta_rows;                                   // delta_edges as row segments
+    size_t delta_total = 0;                                 // side-buffer entries on all ranks
+    size_t wire_raw_bytes = 0;                              // batch bytes before / after wire_codec
+    size_t wire_bytes = 0;
 };
 
 
+/*
+    @brief
+        builds a ygm::container::array from per-rank vectors without a global sort.
+        Each rank's elements are placed after those of all lower ranks, so if every local vector is sorted
+        and the ranks hold increasing ranges, the array comes out globally sorted. Must be called by all ranks.
+
+    @param local_edges: this rank's elements, in the order they should appear
+*/
+std::unique_ptr<ygm::container::array<Edge>> build_sorted_array(ygm::comm &c, const std::vector<Edge> &local_edges);
+
+/*
+    @brief
+        writes this rank's elements to the global indices [offset, offset + local_edges.size()) of arr.
+        They are cut at the block boundaries of arr and each contiguous run is sent to its block's owner in
+        one message, which copies it into place. Must be called by all ranks.
+*/
+void write_edge_runs(ygm::comm &c, ygm::container::array<Edge> &arr, const std::vector<Edge> &local_edges,
+                     size_t offset);
+
+/*
+    @brief bytes held by this rank's part of an A operand, for memory_footprint. 0 for a streamed A.
+*/
+template <class Matrix>
+size_t matrix_bytes(Matrix &matrix);
+
+template <class Matrix>
+size_t matrix_bytes(row_range_view<Matrix> &rows);
+
+/*
+    @brief bytes held by this rank's part of an accumulator for C, for memory_footprint
+*/
+template <typename Key, typename Value>
+size_t accumulator_bytes(flat_accumulator<Key, Value> &accum);
+
+/*
+    @brief
+        estimated bytes of this rank's part of a ygm map: entries times key, value and about two pointers
+        of node overhead (the map does not expose its allocation)
+*/
+template <typename Key, typename Value>
+size_t accumulator_bytes(ygm::container::map<Key, Value> &accum);
+
+/*
+    @brief writes "config" as "name value" lines to "path" on rank 0. Must be called by all ranks.
+*/
+void save_tuned_config(ygm::comm &c, const tuned_config &config, const std::string &path);
+
+/*
+    @brief reads a file written by save_tuned_config(); settings missing from the file keep their defaults
+*/
+tuned_config load_tuned_config(const std::string &path);
+
+/*
+    @brief reads back the C entries spGemm_batched() spilled to "<prefix>.<rank>.spill"
+*/
+std::vector<Edge> read_spilled_edges(const std::string &prefix, int rank);
+
+/*
+    Header of a per-rank snapshot file written by save_edge_snapshot(), followed by local_count Edges.
+*/
+struct snapshot_header{
+    static constexpr uint64_t expected_magic = 0x4f4f435f54524f53ULL;  // "SORT_COO"
+    static constexpr uint32_t current_version = 2;   // 2: "<prefix>.meta" ends with the hub row count and owner table flag
+
+    uint64_t magic = expected_magic;
+    uint32_t version = current_version;
+    uint32_t num_ranks = 0;     // ranks of the run that wrote the snapshot, one file each
+    uint64_t total = 0;         // elements in the whole array
+    uint64_t local_start = 0;   // global index of the file's first element
+    uint64_t local_count = 0;
+};
+
+/*
+    @brief
+        writes this rank's part of a distributed Edge array, in order, to "<prefix>.<rank>.edges".
+        Must be called by all ranks.
+*/
+void save_edge_snapshot(ygm::comm &c, ygm::container::array<Edge> &arr, const std::string &prefix);
+
+/*
+    @brief
+        reads an array written by save_edge_snapshot(), keeping the element order. Every rank reads the files
+        rank, rank + size, ... and places each element at its saved index, so with the same rank count all
+        elements stay on the rank that reads them. Must be called by all ranks.
+*/
+std::unique_ptr<ygm::container::array<Edge>> load_edge_snapshot(ygm::comm &c, const std::string &prefix);
+
+/*
+    @brief
+        transposes a distributed Edge array in one exchange: every rank swaps row and column of its entries and
+        sends them, batched per destination, to the rank owning the new row's range (rows are split into equal
+        contiguous ranges). The receivers sort their rows locally and the result is placed with
+        build_sorted_array(), so it comes back globally row-sorted and ready for Sorted_COO without ygm's sort.
+        Must be called by all ranks.
+
+    @param src: not modified, need not be sorted
+    @param row_degrees: if not null, receives (row, nonzeros) of the transposed rows this rank sorted,
+                        i.e. the column degrees of src. Every row is counted on exactly one rank.
+*/
+std::unique_ptr<ygm::container::array<Edge>> transpose_edges(ygm::comm &c, ygm::container::array<Edge> &src,
+                                                             std::vector<std::pair<int, size_t>> *row_degrees = nullptr);
+
+
 // including the ipp file here removes the need to add it in add_ygm_executable()
 #include "sorted_coo.ipp"
 
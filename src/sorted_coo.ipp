@@ -17,31 +17,121 @@ using std::vector;
     Member functions defined inside the class body are implicitly inline.
 */
 
+inline void Sorted_COO::build_row_owners(){
+    double map_start = MPI_Wtime();
+
+    m_comm.barrier(); 
+    double map_end = MPI_Wtime();
+    m_comm.cout0("row-owner map initialization time: ", map_end - map_start);
+
+    double merge_start = MPI_Wtime();
+    auto populate_row_owners = [](std::pair<int, int> min_max, int rank, auto self){
+        self->row_owners[rank] = min_max;
+    };
+
+    // an empty slice can only be at the tail of the block partition; (INT_MAX, INT_MAX) keeps the
+    // table sorted by last row and never matches in get_owners()
+    int first = std::numeric_limits<int>::max();
+    int last = std::numeric_limits<int>::max();
+    if(sorted_matrix.local_size() > 0){
+        first = sorted_matrix.local_cbegin().operator*().value.row;
+        auto curr = sorted_matrix.local_cbegin();
+        for(;curr != sorted_matrix.local_cend(); curr.operator++()){
+            last = curr.operator*().value.row;
+        }
+    }
+
+    m_comm.async(0, populate_row_owners, 
+                std::make_pair(first, last), 
+                m_comm.rank(), pthis);
+    m_comm.barrier();
+    double merge_end = MPI_Wtime();
+    m_comm.cout0("merge row-owner data time: ", merge_end - merge_start);
+
+    double bc_start = MPI_Wtime();
+    auto broadcast_owners = [](std::vector<std::pair<int, int>> owners, auto self){
+        self->row_owners = owners;
+    };
+    if(m_comm.rank0()){
+        m_comm.async_bcast(broadcast_owners, row_owners, pthis);
+    }
+    m_comm.barrier();
+    cached_row = std::numeric_limits<int>::min();
+    owner_table.clear();
+    double bc_end = MPI_Wtime();
+    m_comm.cout0("broadcast row-owner data time: ", bc_end - bc_start);
+
+    build_local_rows();
+}
+
+inline void Sorted_COO::build_local_rows(){
+    local_rows.clear();
+    sorted_matrix.local_for_all([this](int index, Edge &ed){
+        local_rows.push_back(ed.row, ed.col, ed.value);
+    });
+    local_rows.finish();
+}
+
 inline vector<int> Sorted_COO::get_owners(int source){
 
     vector<int> owners;
-    auto comp_second = [](const std::pair<int, int>& lhs, int val) {
-        return lhs.second < val;
-    };  
-   
-    auto it = std::lower_bound(row_owners.begin(), row_owners.end(), source, comp_second);
-
-    // if it is equal to the end iterator, then theres no owner
-    if(it != row_owners.end()){
-        int owner_rank = it - row_owners.begin();
-        
-        while(owner_rank < row_owners.size()){
-            if(row_owners[owner_rank].first <= source){
-                owners.push_back(owner_rank);
-                owner_rank++;
-            }
-            else{
-                break;
-            }
+    auto [first, last] = owner_range(source);
+    for(int owner_rank = first; owner_rank < last; owner_rank++){
+        owners.push_back(owner_rank);
+    }
+    return owners;
+}
+
+inline std::pair<int, int> Sorted_COO::owner_range(int row){
+    if(row == cached_row){
+        return cached_range;
+    }
+    int first = 0;
+    if(!owner_table.empty()){
+        if(row < 0 || row >= int(owner_table.size()) || owner_table[row] < 0){
+            first = row_owners.size();
         }
+        else{
+            first = owner_table[row];
+        }
+    }
+    else{
+        auto comp_second = [](const std::pair<int, int>& lhs, int val) {
+            return lhs.second < val;
+        };
+        // if it is equal to the end iterator, then theres no owner
+        first = std::lower_bound(row_owners.begin(), row_owners.end(), row, comp_second) - row_owners.begin();
+    }
+    int last = first;
+    while(last < int(row_owners.size()) && row_owners[last].first <= row){
+        last++;
     }
+    cached_row = row;
+    cached_range = {first, last};
+    return cached_range;
+}
 
-    return owners;
+inline void Sorted_COO::build_owner_table(){
+    int max_row = -1;
+    for(const auto &[first, last] : row_owners){
+        if(first != std::numeric_limits<int>::max()){
+            max_row = std::max(max_row, last);
+        }
+    }
+    owner_table.assign(max_row + 1, -1);
+    for(int rank = 0; rank < int(row_owners.size()); rank++){
+        auto [first, last] = row_owners[rank];
+        if(first == std::numeric_limits<int>::max()){
+            continue;
+        }
+        for(int row = std::max(first, 0); row <= last; row++){
+            if(owner_table[row] < 0){
+                owner_table[row] = rank;
+            }
+        }
+    }
+    cached_row = std::numeric_limits<int>::min();
+    m_comm.cout0("owner table: ", owner_table.size(), " rows, ", owner_table.size() * sizeof(int), " bytes per rank");
 }
 
 template<typename Fn, typename... VisitorArgs>
@@ -52,111 +142,344 @@ inline void Sorted_COO::async_visit_row(
         // NOTE: CAPTURING THE DISTRIBUTED CONTAINER BY REFERENCE MAY LEAD TO UNDEFINED BEHAVIOR 
         //     because the distributed container may not be in the same memory address from the remote rank (callee)'s 
         //     memory layout
-    auto vlambda = 
-        [user_func](const VisitorArgs... args) mutable { // lambda are const by default; args are read-only
-            std::invoke(user_func, args...);
-        };
-    
-    vector<int> owners = get_owners(target_row);
-    for(int owner_rank : owners){
+    // user_func goes out as is: wrapping it in another lambda would copy every argument once more per owner
+    auto [first, last] = owner_range(target_row);
+    for(int owner_rank = first; owner_rank < last; owner_rank++){
         //printf("Row %d is owned by rank %d\n", target_row, owner_rank);
         assert(owner_rank >= 0 && owner_rank < m_comm.size());
-        m_comm.async(owner_rank, vlambda, args...);
+        route(owner_rank, user_func, args...);
+    }
+}
+
+template <typename Fn, typename... Args>
+inline void Sorted_COO::route(int dest, Fn fn, const Args&... args){
+    if(router){
+        router->async(dest, fn, args...);
+    }
+    else{
+        m_comm.async(dest, fn, args...);
+    }
+}
+
+template <typename AccumPtr, typename Fn, typename... Args>
+inline void Sorted_COO::visit_accumulator(AccumPtr pmap, const map_key &key, Fn fn, const Args&... args){
+    if(!router){
+        pmap->async_visit(key, fn, args...);
+        return;
+    }
+    auto deliver = [fn](auto pmap, const map_key &key, const Args&... args){
+        pmap->async_visit(key, fn, args...);  // already on the owner of key
+    };
+    router->async(pmap->partitioner.owner(key), deliver, pmap, key, args...);
+}
+
+template <typename AccumPtr>
+inline void Sorted_COO::esc_insert(AccumPtr pmap, const map_key &key, int product){
+    int dest = pmap->partitioner.owner(key);
+    if(esc->insert(dest, pack_key(key), product)){
+        esc_send(pmap, dest);
+    }
+}
+
+template <typename AccumPtr>
+inline void Sorted_COO::esc_send(AccumPtr pmap, int dest){
+    auto apply_batch = [](auto pmap, const std::vector<uint64_t> &keys, const std::vector<int> &values){
+        // this rank owns every key
+        if constexpr (requires { pmap->local_add_batch(keys, values); }){
+            pmap->local_add_batch(keys, values);
+        }
+        else{
+            auto adder = [](const auto &key, auto &partial_product, auto to_add){
+                partial_product += to_add;
+            };
+            for(size_t i = 0; i < keys.size(); i++){
+                pmap->async_visit(unpack_key(keys[i]), adder, values[i]);
+            }
+        }
+    };
+    std::vector<uint64_t> keys;
+    std::vector<int> values;
+    esc->drain(dest, keys, values);
+    if(!compress_messages){
+        route(dest, apply_batch, pmap, keys, values);
+        return;
+    }
+    // drained buffers are compressed, so the keys are sorted
+    auto apply_packed = [apply_batch](auto pmap, const std::vector<uint8_t> &bytes){
+        std::vector<uint64_t> keys;
+        std::vector<int> values;
+        wire_codec<int>::decode(bytes, keys, values);
+        apply_batch(pmap, keys, values);
+    };
+    std::vector<uint8_t> bytes;
+    wire_bytes += wire_codec<int>::encode(keys, values, bytes);
+    wire_raw_bytes += wire_codec<int>::raw_bytes(keys.size());
+    route(dest, apply_packed, pmap, bytes);
+}
+
+inline std::vector<uint8_t> Sorted_COO::encode_edges(std::vector<Edge> &batch){
+    std::sort(batch.begin(), batch.end(), [](const Edge &lhs, const Edge &rhs){
+        return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+    });
+    std::vector<uint64_t> keys(batch.size());
+    std::vector<int> values(batch.size());
+    for(size_t i = 0; i < batch.size(); i++){
+        keys[i] = pack_key({batch[i].row, batch[i].col});
+        values[i] = batch[i].value;
+    }
+    std::vector<uint8_t> bytes;
+    wire_bytes += wire_codec<int>::encode(keys, values, bytes);
+    wire_raw_bytes += batch.size() * sizeof(Edge);
+    return bytes;
+}
+
+inline void Sorted_COO::decode_edges(const std::vector<uint8_t> &bytes){
+    std::vector<uint64_t> keys;
+    std::vector<int> values;
+    wire_codec<int>::decode(bytes, keys, values);
+    row_inbox.reserve(row_inbox.size() + keys.size());
+    for(size_t i = 0; i < keys.size(); i++){
+        map_key key = unpack_key(keys[i]);
+        row_inbox.push_back({key.x, key.y, values[i]});
+    }
+}
+
+inline void Sorted_COO::print_wire_stats(){
+    size_t raw = ygm::sum(wire_raw_bytes, m_comm);
+    size_t packed = ygm::sum(wire_bytes, m_comm);
+    m_comm.cout0("wire_codec: ", raw, " batch bytes sent as ", packed, " (",
+                 packed > 0 ? double(raw) / packed : 0.0, "x)");
+}
+
+inline size_t Sorted_COO::local_bytes() const {
+    size_t bytes = sorted_matrix.local_size() * sizeof(Edge) + local_rows.local_bytes();
+    bytes += row_owners.capacity() * sizeof(row_owners[0]);
+    bytes += owner_table.capacity() * sizeof(int);
+    for(const auto &[row, edges] : hub_rows){
+        bytes += sizeof(row) + edges.capacity() * sizeof(Edge);
+    }
+    bytes += row_inbox.capacity() * sizeof(Edge);
+    bytes += node_inbox.capacity() * sizeof(node_inbox[0]);
+    bytes += (pending_delta.capacity() + delta_edges.capacity()) * sizeof(Edge);
+    bytes += pending_rows.local_bytes() + delta_rows.local_bytes();
+    return bytes;
+}
+
+template <class Matrix, class Accumulator>
+inline void Sorted_COO::record_multiply_memory(const spgemm_options &opts, Matrix &matrix_A, Accumulator &partial_accum,
+                                               size_t cache_bytes){
+    if(opts.memory == nullptr || !pass_stats){
+        return;
+    }
+    opts.memory->record("multiply", {{"A", matrix_bytes(matrix_A)},
+                                     {"B", local_bytes()},
+                                     {"C", accumulator_bytes(partial_accum)},
+                                     {"proc_cache", cache_bytes},
+                                     {"esc buffers", esc ? esc->local_bytes() : 0},
+                                     {"configured comm buffers", memory_footprint::configured_comm_buffer_bytes()}});
+}
+
+template <class Matrix>
+inline size_t matrix_bytes(Matrix &matrix){
+    if constexpr (requires { matrix.local_size(); }){
+        return matrix.local_size() * sizeof(Edge);
+    }
+    else{
+        return 0;
+    }
+}
+
+template <class Matrix>
+inline size_t matrix_bytes(row_range_view<Matrix> &rows){
+    return matrix_bytes(rows.matrix);
+}
+
+template <typename Key, typename Value>
+inline size_t accumulator_bytes(flat_accumulator<Key, Value> &accum){
+    return accum.local_bytes();
+}
+
+template <typename Key, typename Value>
+inline size_t accumulator_bytes(ygm::container::map<Key, Value> &accum){
+    return accum.local_size() * (sizeof(Key) + sizeof(Value) + 2 * sizeof(void*));
+}
+
+template <typename AccumPtr>
+inline void Sorted_COO::esc_flush_all(AccumPtr pmap){
+    for(int dest = 0; dest < esc->num_dest(); dest++){
+        if(!esc->empty(dest)){
+            esc->compress(dest);
+            esc_send(pmap, dest);
+        }
     }
+    if(pass_stats){
+        print_esc_stats();
+    }
+}
+
+inline void Sorted_COO::print_esc_stats(){
+    size_t inserted = ygm::sum(esc->inserted_count(), m_comm);
+    size_t sent = ygm::sum(esc->sent_count(), m_comm);
+    m_comm.cout0("expand-sort-compress: ", inserted, " products sent as ", sent, " entries");
 }
 
 
 // input_value, input_row, input_column, pmap
 
 template <class Matrix, class Accumulator>
-inline void Sorted_COO::spGemm(Matrix &unsorted_matrix, Accumulator &partial_accum){
+inline void Sorted_COO::spGemm(Matrix &unsorted_matrix, Accumulator &partial_accum, const spgemm_options &opts){
+    merge_delta();
+    if(opts.two_hop_routing && !router){
+        router = std::make_unique<node_router>(m_comm);
+    }
+    else if(!opts.two_hop_routing){
+        router.reset();
+    }
+    compress_messages = opts.compress_messages;
+    upper_triangle = opts.upper_triangle;
+    pass_stats = true;
+    wire_raw_bytes = 0;
+    wire_bytes = 0;
+    esc.reset();
+    if(opts.esc_buffer_entries > 0){
+        esc = std::make_unique<esc_buffer<int>>(m_comm.size(), opts.esc_buffer_entries);
+    }
+
+    if(opts.memory_budget > 0){
+        spGemm_batched(unsorted_matrix, partial_accum, opts);
+        return;
+    }
+    spGemm_impl(unsorted_matrix, partial_accum, opts);
+}
+
+template <class Matrix, class Accumulator>
+inline void Sorted_COO::spGemm_impl(Matrix &unsorted_matrix, Accumulator &partial_accum, const spgemm_options &opts){
+    if(opts.num_threads != 1){
+        spGemm_threaded(unsorted_matrix, partial_accum, opts);
+        return;
+    }
+
     int mult_count = 0;
     auto mult_count_ptr = m_comm.make_ygm_ptr(mult_count);
     int add_count = 0;
     auto add_count_ptr = m_comm.make_ygm_ptr(add_count);
-    m_comm.stats_reset();
+    if(pass_stats){
+        m_comm.stats_reset();
+    }
 
     m_comm.barrier();
 
     //#define CACHE
 
     #ifdef CACHE
-    proc_cache cache(m_comm, partial_accum, top_k);
+    proc_cache<map_key, int, Accumulator> cache(m_comm, partial_accum, top_k);
     #endif
 
     #ifndef CACHE
     int cache;
     #endif
     auto cache_ptr = m_comm.make_ygm_ptr(cache);
-    auto multiplier = [](auto pmap, auto self, 
-                        int input_value, int input_row, int input_column,
-                        auto cache_ptr, auto mult_count_ptr, auto add_count_ptr){
-         // find the first Edge with matching row to input_column with std::lower_bound
-        int low = self->sorted_matrix.partitioner.local_start();
-        int high = low + self->sorted_matrix.partitioner.local_size();
-        int upper_bound = high;
-
-        while (low < high) {
-            int mid = low + (high - low) / 2;
-
-            Edge mid_edge = {};
-            // local visit expects a global index. internally, converts it into a local index: 0 to local size
-            self->sorted_matrix.local_visit(mid, [&mid_edge](int index, Edge &edge){
-                mid_edge = edge;
-            });
-
-            if (mid_edge.row < input_column) { // the edge with matching row has to be to the right of mid
-                low = mid + 1;
-            }
-            else { // the first edge with matching row has to be to the left of mid
-                high = mid;
-            }
-        }
 
-        // keep multiplying with the next Edge until the row number no longer matches
-        for(int i = low; i < upper_bound; i++){
-            Edge match_edge = {};  
-            self->sorted_matrix.local_visit(i, [&match_edge](int index, Edge &edge){
-                match_edge = edge;
-            });
-            if(match_edge.row != input_column){
-                break;
-            }
+    // sends one partial product to C (or to the cache when the key is a top pair)
+    auto accumulate = [](auto pmap, auto self, int row, int col, int product,
+                        auto cache_ptr, auto add_count_ptr){
+        auto adder = [](const auto &key, auto &partial_product, auto to_add,
+                        auto add_count_ptr){
+            partial_product += to_add;
+            (*add_count_ptr)++;
+        };
 
-            // NOTE: could potentially overflow with large values
-            int product = input_value * match_edge.value; // valueB * valueA;
+        #ifdef CACHE
+        if(self->top_pairs.count({row, col})){
+            (*cache_ptr).cache_insert({row, col}, product);
+            return;
+        }
+        #endif
 
-            if(product == 0){
-                continue;
-            }
-            (*mult_count_ptr)++;
-            auto adder = [](const auto &key, auto &partial_product, auto to_add,
-                            auto add_count_ptr){
-                partial_product += to_add;
-                (*add_count_ptr)++;
-            };
+        if(self->esc){
+            self->esc_insert(pmap, {row, col}, product);
+        }
+        else{
+            self->visit_accumulator(pmap, {row, col}, adder, product, add_count_ptr); // Boost's hasher complains if I use a struct
+        }
+    };
 
-            #ifdef CACHE
-            if(self->top_pairs.count({input_row, match_edge.col})){
-                (*cache_ptr).cache_insert({input_row, match_edge.col}, product);
-            }
-            else{
-                pmap->async_visit({input_row, match_edge.col}, adder, product, add_count_ptr); // Boost's hasher complains if I use a struct
+    auto multiplier = [accumulate](auto pmap, auto self, 
+                        int input_value, int input_row, int input_column,
+                        auto cache_ptr, auto mult_count_ptr, auto add_count_ptr){
+        auto [low, upper_bound] = self->local_rows.row_segment(input_column);
+        if(self->upper_triangle){
+            const int *cols = self->local_rows.cols();
+            low = std::lower_bound(cols + low, cols + upper_bound, input_row) - cols;
+        }
+        /*
+            multiply the local segment of the matching row in blocks, then send the products. The buffers
+            live on the stack because accumulate() may let ygm run another multiplier before it returns.
+        */
+        constexpr size_t block = 256;
+        uint64_t keys[block];
+        int products[block];
+        for(size_t offset = low; offset < upper_bound; offset += block){
+            size_t length = std::min(block, upper_bound - offset);
+            size_t count = scale_row(self->local_rows.cols() + offset, self->local_rows.values() + offset, length,
+                                     input_value, input_row, keys, products);
+            (*mult_count_ptr) += int(count);
+            for(size_t i = 0; i < count; i++){
+                map_key key = unpack_key(keys[i]);
+                accumulate(pmap, self, key.x, key.y, products[i], cache_ptr, add_count_ptr);
             }
-            #endif
-
-            #ifndef CACHE
-            pmap->async_visit({input_row, match_edge.col}, adder, product, add_count_ptr); // Boost's hasher complains if I use a struct
-            #endif
-
-        }   
+        }
     }; 
     
     ygm::ygm_ptr<Accumulator> pmap(&partial_accum);
+    #ifdef CACHE
+    // flushed cache entries take the same route as the other C updates
+    cache.set_sender([this, pmap](const map_key &key, int value){
+        auto adder = [](const auto &key, auto &partial_product, auto to_add){
+            partial_product += to_add;
+        };
+        visit_accumulator(pmap, key, adder, value);
+    });
+    #endif
     unsorted_matrix.local_for_all([&](int index, Edge &ed){
         int input_column = ed.col;
         int input_row = ed.row;
         int input_value = ed.value;
+
+        // multiplies with B Edges that can be read from this rank, without visiting the row owners
+        auto multiply_here = [&](const Edge *begin, const Edge *end){
+            for(const Edge *match_edge = first_product_edge(begin, end, input_row); match_edge != end; match_edge++){
+                int product = input_value * match_edge->value;
+                if(product == 0){
+                    continue;
+                }
+                mult_count++;
+                accumulate(pmap, pthis, input_row, match_edge->col, product, cache_ptr, add_count_ptr);
+            }
+        };
+
+        auto hub = hub_rows.find(input_column);
+        if(hub != hub_rows.end()){
+            multiply_here(hub->second.data(), hub->second.data() + hub->second.size());
+            return;
+        }
+
+        if(node_slices){
+            auto [first, last] = owner_range(input_column);
+            for(int owner_rank = first; owner_rank < last; owner_rank++){
+                if(node_slices->is_node_local(owner_rank)){
+                    auto [begin, end] = node_row_range(owner_rank, input_column);
+                    multiply_here(begin, end);
+                }
+                else{
+                    route(owner_rank, multiplier,
+                                pmap, pthis, input_value, input_row, input_column,
+                                cache_ptr, mult_count_ptr, add_count_ptr);
+                }
+            }
+            return;
+        }
+
         async_visit_row(input_column, multiplier, 
                         pmap, pthis, input_value, input_row, input_column,
                         cache_ptr, mult_count_ptr, add_count_ptr);
@@ -165,11 +488,1807 @@ inline void Sorted_COO::spGemm(Matrix &unsorted_matrix, Accumulator &partial_acc
     #ifdef CACHE
     cache.cache_flush_all();
     #endif
-    m_comm.stats_print();
+    if(esc){
+        esc_flush_all(pmap);
+        m_comm.barrier();
+    }
+    if(compress_messages && pass_stats){
+        print_wire_stats();
+    }
+    #ifdef CACHE
+    record_multiply_memory(opts, unsorted_matrix, partial_accum, cache.local_bytes());
+    #else
+    record_multiply_memory(opts, unsorted_matrix, partial_accum, 0);
+    #endif
+    if(pass_stats){
+        m_comm.stats_print();
+    }
     //m_comm.cout("number of multiplication: ", mult_count, ", number of addition: ", add_count);
 
 }
 
+template <class Matrix, class Accumulator>
+inline void Sorted_COO::spGemm_batched(Matrix &unsorted_matrix, Accumulator &partial_accum, const spgemm_options &opts){
+    double plan_start = MPI_Wtime();
+
+    // estimated products: every A entry meets one B row of average length
+    size_t local_b_rows = 0;
+    int previous_row = -1;
+    sorted_matrix.local_for_all([&](int index, Edge &ed){
+        if(ed.row != previous_row || local_b_rows == 0){
+            local_b_rows++;
+            previous_row = ed.row;
+        }
+    });
+    size_t b_rows = std::max<size_t>(1, ygm::sum(local_b_rows, m_comm));
+    double avg_b_row = double(sorted_matrix.size()) / b_rows;
+
+    int local_max_row = -1;
+    size_t local_a_nnz = 0;
+    unsorted_matrix.local_for_all([&](int index, Edge &ed){
+        local_max_row = std::max(local_max_row, ed.row);
+        local_a_nnz++;
+    });
+    int num_rows = ygm::max(local_max_row, m_comm) + 1;
+    size_t a_nnz = ygm::sum(local_a_nnz, m_comm);
+
+    // a product costs its C update message and, until C is spilled, an accumulator entry
+    constexpr size_t entry_bytes = sizeof(map_key) + sizeof(int);
+    // per-entry bookkeeping beyond the entry itself: the next pointer and cached hash of a node-based map,
+    // or about the empty slots flat_accumulator keeps at its 0.7 load factor
+    constexpr size_t entry_overhead = 2 * sizeof(void*);
+    constexpr double bytes_per_product = 2 * entry_bytes + entry_overhead;
+    double total_bytes = a_nnz * avg_b_row * bytes_per_product;
+    if(opts.upper_triangle){
+        total_bytes /= 2;   // about half of the products fall below the diagonal and are skipped
+    }
+    double budget = double(opts.memory_budget) * m_comm.size();
+    int num_batches = std::max(1, int(std::min<double>(num_rows, std::ceil(total_bytes / budget))));
+
+    /*
+        Batch boundaries: A's nonzeros are counted in row buckets on rank 0, which cuts the buckets into
+        num_batches ranges of about equal nonzeros and broadcasts the first row of every range.
+    */
+    int num_buckets = std::max(1, std::min(num_rows, 4096));
+    int bucket_rows = (num_rows + num_buckets - 1) / num_buckets;
+    std::vector<size_t> local_histogram(num_buckets, 0);
+    unsorted_matrix.local_for_all([&](int index, Edge &ed){
+        local_histogram[ed.row / bucket_rows]++;
+    });
+    std::vector<size_t> histogram(num_buckets, 0);
+    std::vector<int> boundaries;
+    auto histogram_ptr = m_comm.make_ygm_ptr(histogram);
+    auto boundaries_ptr = m_comm.make_ygm_ptr(boundaries);
+    auto add_histogram = [](auto phistogram, const std::vector<size_t> &counts){
+        for(size_t i = 0; i < counts.size(); i++){
+            (*phistogram)[i] += counts[i];
+        }
+    };
+    m_comm.async(0, add_histogram, histogram_ptr, local_histogram);
+    m_comm.barrier();
+    auto set_boundaries = [](auto pboundaries, const std::vector<int> &rows){
+        *pboundaries = rows;
+    };
+    if(m_comm.rank0()){
+        boundaries.push_back(0);
+        size_t target = (a_nnz + num_batches - 1) / num_batches;
+        size_t in_batch = 0;
+        for(int bucket = 0; bucket < num_buckets; bucket++){
+            in_batch += histogram[bucket];
+            if(in_batch >= target && int(boundaries.size()) < num_batches && bucket + 1 < num_buckets){
+                boundaries.push_back((bucket + 1) * bucket_rows);
+                in_batch = 0;
+            }
+        }
+        boundaries.push_back(num_rows);
+        m_comm.async_bcast(set_boundaries, boundaries_ptr, boundaries);
+    }
+    m_comm.barrier();
+    double plan_end = MPI_Wtime();
+    m_comm.cout0("batched spGemm: ", boundaries.size() - 1, " batches for about ", size_t(a_nnz * avg_b_row),
+                 " products, planning time: ", plan_end - plan_start);
+
+    std::string spill_file = opts.spill_prefix + "." + std::to_string(m_comm.rank()) + ".spill";
+    std::ofstream spill;
+    if(!opts.spill_prefix.empty()){
+        spill.open(spill_file, std::ios::binary | std::ios::trunc);
+        YGM_ASSERT_RELEASE(spill.is_open() == true);
+    }
+    size_t spilled = 0;
+    // the passes print their statistics only with print_batch_stats; otherwise they are summed up below
+    pass_stats = opts.print_batch_stats;
+    if(!pass_stats){
+        m_comm.stats_reset();
+    }
+    for(size_t batch = 0; batch + 1 < boundaries.size(); batch++){
+        double batch_start = MPI_Wtime();
+        row_range_view<Matrix> rows{unsorted_matrix, boundaries[batch], boundaries[batch + 1]};
+        spGemm_impl(rows, partial_accum, opts);
+        m_comm.barrier();
+        if(spill.is_open()){
+            // C holds complete rows of this batch only
+            std::vector<Edge> finished;
+            partial_accum.local_for_all([&finished](const map_key &key, int value){
+                finished.push_back({key.x, key.y, value});
+            });
+            spill.write(reinterpret_cast<const char*>(finished.data()), finished.size() * sizeof(Edge));
+            spilled += finished.size();
+            partial_accum.clear();
+        }
+        double batch_end = MPI_Wtime();
+        if(opts.print_batch_stats){
+            m_comm.cout0("batch ", batch, " (rows ", boundaries[batch], " to ", boundaries[batch + 1], ") time: ",
+                         batch_end - batch_start);
+        }
+    }
+    pass_stats = true;
+    m_comm.cout0("batched spGemm: ", boundaries.size() - 1, " batches done in ", MPI_Wtime() - plan_end);
+    if(!opts.print_batch_stats){
+        record_multiply_memory(opts, unsorted_matrix, partial_accum, 0);
+        if(esc){
+            print_esc_stats();
+        }
+        if(compress_messages){
+            print_wire_stats();
+        }
+        m_comm.stats_print();
+    }
+    if(spill.is_open()){
+        spill.close();
+        YGM_ASSERT_RELEASE(spill.fail() == false);
+        m_comm.cout0("spilled ", ygm::sum(spilled, m_comm), " C entries to ", opts.spill_prefix, ".<rank>.spill");
+    }
+}
+
+inline std::vector<Edge> read_spilled_edges(const std::string &prefix, int rank){
+    std::ifstream in(prefix + "." + std::to_string(rank) + ".spill", std::ios::binary | std::ios::ate);
+    YGM_ASSERT_RELEASE(in.is_open() == true);
+    std::vector<Edge> edges(size_t(in.tellg()) / sizeof(Edge));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(edges.data()), edges.size() * sizeof(Edge));
+    return edges;
+}
+
+template <class Matrix, class Accumulator>
+inline void Sorted_COO::spGemm_threaded(Matrix &unsorted_matrix, Accumulator &partial_accum, const spgemm_options &opts){
+    int num_threads = opts.num_threads;
+    if(num_threads <= 0){
+        // share the cores of the node between the ranks placed on it
+        num_threads = std::max(1u, std::thread::hardware_concurrency() / m_comm.layout().local_size());
+    }
+    size_t batch_size = std::max<size_t>(1, opts.batch_size);
+    if(pass_stats){
+        m_comm.stats_reset();
+    }
+    m_comm.barrier();
+
+    /*
+        Stage 1: ship every local A entry to the owner(s) of row "A.col" of B.
+        Entries are packed per destination so a message carries a batch instead of a single Edge.
+    */
+    double route_start = MPI_Wtime();
+    auto receive_batch = [](auto self, const std::vector<Edge> &batch){
+        self->row_inbox.insert(self->row_inbox.end(), batch.begin(), batch.end());
+    };
+    auto receive_packed = [](auto self, const std::vector<uint8_t> &bytes){
+        self->decode_edges(bytes);
+    };
+    auto send_batch = [&](int owner_rank, std::vector<Edge> &batch){
+        if(compress_messages){
+            route(owner_rank, receive_packed, pthis, encode_edges(batch));
+        }
+        else{
+            route(owner_rank, receive_batch, pthis, batch);
+        }
+        batch.clear();
+    };
+    std::vector<std::vector<Edge>> outgoing(m_comm.size());
+    unsorted_matrix.local_for_all([&](int index, Edge &ed){
+        if(hub_rows.count(ed.col)){
+            row_inbox.push_back(ed);  // replicated locally, see replicate_hub_rows()
+            return;
+        }
+        auto [first, last] = owner_range(ed.col);
+        for(int owner_rank = first; owner_rank < last; owner_rank++){
+            if(owner_rank == m_comm.rank()){
+                row_inbox.push_back(ed);
+                continue;
+            }
+            if(node_slices && node_slices->is_node_local(owner_rank)){
+                node_inbox.push_back({owner_rank, ed});
+                continue;
+            }
+            std::vector<Edge> &batch = outgoing[owner_rank];
+            batch.push_back(ed);
+            if(batch.size() >= batch_size){
+                send_batch(owner_rank, batch);
+            }
+        }
+    });
+    for(int owner_rank = 0; owner_rank < m_comm.size(); owner_rank++){
+        if(!outgoing[owner_rank].empty()){
+            send_batch(owner_rank, outgoing[owner_rank]);
+        }
+    }
+    outgoing.clear();
+    m_comm.barrier();
+    double route_end = MPI_Wtime();
+    if(pass_stats){
+        m_comm.cout0("threaded spGemm routing time: ", route_end - route_start);
+    }
+
+    /*
+        Stage 2: the threads share the read-only local slice of B and pull chunks of the inbox.
+        No ygm call is made from a worker thread; the comm is only used again after the join.
+    */
+    double mult_start = MPI_Wtime();
+    // entries of the same B row next to each other, so a worker multiplies each row segment by a run of scalars
+    std::sort(row_inbox.begin(), row_inbox.end(), [](const Edge &lhs, const Edge &rhs){
+        return lhs.col != rhs.col ? lhs.col < rhs.col : lhs.row < rhs.row;
+    });
+    constexpr size_t chunk_size = 1024;  // power-law rows make static partitioning unbalanced
+    // products one kernel call writes, like the 256-entry block of the single-threaded multiplier;
+    // bounds the scratch buffers of a thread however long the B row and the run of scalars are
+    constexpr size_t block_products = 1 << 14;
+    // a thread stops taking chunks once its partial sums hold this many entries, so a round never
+    // keeps more than num_threads such maps before they are sent to C
+    constexpr size_t thread_accum_limit = 1 << 20;
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> next_node_chunk{0};
+    std::vector<boost::unordered_flat_map<map_key, int>> thread_accum(num_threads);
+
+    auto worker = [&](int tid){
+        auto &accum = thread_accum[tid];
+        std::vector<int> scalars;
+        std::vector<int> out_rows;
+        std::vector<uint64_t> keys(block_products);
+        std::vector<int> products(block_products);
+        auto add_products = [&](size_t count){
+            for(size_t i = 0; i < count; i++){
+                accum[unpack_key(keys[i])] += products[i];
+            }
+        };
+        size_t begin;
+        // entries whose row sits in a node peer's slice, read through shared memory
+        while(accum.size() < thread_accum_limit &&
+              (begin = next_node_chunk.fetch_add(chunk_size)) < node_inbox.size()){
+            size_t end = std::min(begin + chunk_size, node_inbox.size());
+            for(size_t e = begin; e < end; e++){
+                const auto &[owner_rank, a_edge] = node_inbox[e];
+                auto [row_begin, row_end] = node_row_range(owner_rank, a_edge.col);
+                for(const Edge *match_edge = first_product_edge(row_begin, row_end, a_edge.row);
+                    match_edge != row_end; match_edge++){
+                    int product = a_edge.value * match_edge->value;
+                    if(product != 0){
+                        accum[{a_edge.row, match_edge->col}] += product;
+                    }
+                }
+            }
+        }
+        while(accum.size() < thread_accum_limit &&
+              (begin = next_chunk.fetch_add(chunk_size)) < row_inbox.size()){
+            size_t end = std::min(begin + chunk_size, row_inbox.size());
+            size_t e = begin;
+            while(e < end){
+                const Edge &a_edge = row_inbox[e];
+                auto hub = hub_rows.find(a_edge.col);
+                if(hub != hub_rows.end()){
+                    const Edge *hub_end = hub->second.data() + hub->second.size();
+                    for(const Edge *match_edge = first_product_edge(hub->second.data(), hub_end, a_edge.row);
+                        match_edge != hub_end; match_edge++){
+                        int product = a_edge.value * match_edge->value;
+                        if(product != 0){
+                            accum[{a_edge.row, match_edge->col}] += product;
+                        }
+                    }
+                    e++;
+                    continue;
+                }
+                // the run of A entries in this chunk that hit the same B row
+                scalars.clear();
+                out_rows.clear();
+                for(; e < end && row_inbox[e].col == a_edge.col; e++){
+                    scalars.push_back(row_inbox[e].value);
+                    out_rows.push_back(row_inbox[e].row);
+                }
+                auto [low, high] = local_rows.row_segment(a_edge.col);
+                size_t length = high - low;
+                const int *cols = local_rows.cols() + low;
+                const int *values = local_rows.values() + low;
+                if(length <= block_products){
+                    // as many scalars per call as fit one block
+                    size_t per_block = block_products / std::max<size_t>(1, length);
+                    for(size_t j = 0; j < scalars.size(); j += per_block){
+                        size_t m = std::min(per_block, scalars.size() - j);
+                        add_products(scale_row_batch(cols, values, length, scalars.data() + j, out_rows.data() + j, m,
+                                                     keys.data(), products.data(), upper_triangle));
+                    }
+                    continue;
+                }
+                // a row longer than a block: one scalar at a time, in block-sized pieces of the row
+                for(size_t j = 0; j < scalars.size(); j++){
+                    size_t first = upper_triangle ? std::lower_bound(cols, cols + length, out_rows[j]) - cols : 0;
+                    for(size_t offset = first; offset < length; offset += block_products){
+                        size_t n = std::min(block_products, length - offset);
+                        add_products(scale_row(cols + offset, values + offset, n, scalars[j], out_rows[j],
+                                               keys.data(), products.data()));
+                    }
+                }
+            }
+        }
+    };
+
+    /*
+        Stage 3: rounds of Stage 2. After each round the threads have joined and every thread's partial sums
+        are sent to C as they are, without merging them into one map first, then emptied.
+    */
+    auto adder = [](const auto &key, auto &partial_product, auto to_add){
+        partial_product += to_add;
+    };
+    ygm::ygm_ptr<Accumulator> pmap(&partial_accum);
+    double send_time = 0;
+    int rounds = 0;
+    while(next_chunk.load() < row_inbox.size() || next_node_chunk.load() < node_inbox.size()){
+        std::vector<std::thread> pool;
+        for(int t = 1; t < num_threads; t++){
+            pool.emplace_back(worker, t);
+        }
+        worker(0);
+        for(std::thread &th : pool){
+            th.join();
+        }
+        rounds++;
+
+        double send_start = MPI_Wtime();
+        for(auto &accum : thread_accum){
+            for(auto &[key, value] : accum){
+                if(esc){
+                    esc_insert(pmap, key, value);
+                }
+                else{
+                    visit_accumulator(pmap, key, adder, value);
+                }
+            }
+            accum.clear();
+        }
+        send_time += MPI_Wtime() - send_start;
+    }
+    double mult_end = MPI_Wtime();
+    if(pass_stats){
+        m_comm.cout0("threaded spGemm multiply time (", num_threads, " threads, ", rounds, " rounds): ",
+                     mult_end - mult_start - send_time, ", sending partial sums: ", send_time);
+    }
+    if(esc){
+        esc_flush_all(pmap);
+    }
+    m_comm.barrier();
+    if(compress_messages && pass_stats){
+        print_wire_stats();
+    }
+    record_multiply_memory(opts, unsorted_matrix, partial_accum, 0);
+    row_inbox.clear();
+    row_inbox.shrink_to_fit();
+    node_inbox.clear();
+    node_inbox.shrink_to_fit();
+    if(pass_stats){
+        m_comm.stats_print();
+    }
+}
+
+inline std::vector<std::pair<int, size_t>> Sorted_COO::top_row_degrees(size_t count){
+    hub_candidates.clear();
+    m_comm.barrier();
+    if(count == 0){
+        return {};
+    }
+
+    /*
+        The local slice is sorted, so the local degree of a row is the length of its run.
+        A row that is entirely local has its global degree here; only the first and the last run
+        may continue on a neighbouring rank. Sending the local top count runs plus the two boundary
+        runs to rank 0 is therefore enough for rank 0 to find the exact global top count rows.
+    */
+    std::vector<std::pair<int, size_t>> runs;
+    for(auto curr = sorted_matrix.local_cbegin(); curr != sorted_matrix.local_cend(); curr.operator++()){
+        int row = curr.operator*().value.row;
+        if(runs.empty() || runs.back().first != row){
+            runs.push_back({row, 0});
+        }
+        runs.back().second++;
+    }
+
+    std::vector<std::pair<int, size_t>> candidates;
+    if(!runs.empty()){
+        candidates.push_back(runs.front());
+        if(runs.size() > 1){
+            candidates.push_back(runs.back());
+        }
+        auto by_count = [](const std::pair<int, size_t> &lhs, const std::pair<int, size_t> &rhs){
+            return lhs.second > rhs.second;
+        };
+        if(runs.size() > 2){
+            size_t keep = std::min(count, runs.size() - 2);
+            std::partial_sort(runs.begin() + 1, runs.begin() + 1 + keep, runs.end() - 1, by_count);
+            candidates.insert(candidates.end(), runs.begin() + 1, runs.begin() + 1 + keep);
+        }
+    }
+
+    auto merge_candidates = [](auto self, const std::vector<std::pair<int, size_t>> &incoming){
+        for(const auto &[row, count] : incoming){
+            self->hub_candidates[row] += count;
+        }
+    };
+    m_comm.async(0, merge_candidates, pthis, candidates);
+    m_comm.barrier();
+
+    std::vector<std::pair<int, size_t>> top_rows;
+    auto top_rows_ptr = m_comm.make_ygm_ptr(top_rows);
+    auto set_top_rows = [](auto ptop_rows, const std::vector<std::pair<int, size_t>> &rows){
+        *ptop_rows = rows;
+    };
+    if(m_comm.rank0()){
+        std::vector<std::pair<int, size_t>> totals(hub_candidates.begin(), hub_candidates.end());
+        auto comp_count = [](const std::pair<int, size_t> &lhs, const std::pair<int, size_t> &rhs){
+            if(lhs.second == rhs.second){
+                return lhs.first < rhs.first;
+            }
+            return lhs.second > rhs.second;
+        };
+        size_t keep = std::min(count, totals.size());
+        std::partial_sort(totals.begin(), totals.begin() + keep, totals.end(), comp_count);
+        totals.resize(keep);
+        m_comm.async_bcast(set_top_rows, top_rows_ptr, totals);
+        hub_candidates.clear();
+    }
+    m_comm.barrier();
+    return top_rows;
+}
+
+inline void Sorted_COO::replicate_hub_rows(size_t num_hubs){
+    double hub_start = MPI_Wtime();
+    hub_rows.clear();
+    m_comm.barrier();
+    if(num_hubs == 0){
+        return;
+    }
+
+    for(const auto &[row, degree] : top_row_degrees(num_hubs)){
+        hub_rows[row];  // creates an empty entry, filled below
+    }
+
+    // every rank broadcasts its share of the hub rows
+    std::vector<Edge> local_hub_edges;
+    sorted_matrix.local_for_all([&](int index, Edge &ed){
+        if(hub_rows.count(ed.row)){
+            local_hub_edges.push_back(ed);
+        }
+    });
+    auto receive_hub_edges = [](auto self, const std::vector<Edge> &edges){
+        for(const Edge &ed : edges){
+            self->hub_rows[ed.row].push_back(ed);
+        }
+    };
+    if(!local_hub_edges.empty()){
+        m_comm.async_bcast(receive_hub_edges, pthis, local_hub_edges);
+    }
+    m_comm.barrier();
+
+    size_t replicated_nnz = 0;
+    for(auto &[row, edges] : hub_rows){
+        std::sort(edges.begin(), edges.end());  // the shares arrive in any order
+        replicated_nnz += edges.size();
+    }
+    double hub_end = MPI_Wtime();
+    m_comm.cout0("replicated ", hub_rows.size(), " hub rows (", replicated_nnz, " nonzeros) in ", hub_end - hub_start);
+}
+
+inline void Sorted_COO::share_node_slices(){
+    double share_start = MPI_Wtime();
+    std::vector<Edge> local_slice;
+    local_slice.reserve(sorted_matrix.local_size());
+    sorted_matrix.local_for_all([&local_slice](int index, Edge &ed){
+        local_slice.push_back(ed);
+    });
+    if(node_slices){
+        node_slices->release();
+    }
+    node_slices = std::make_unique<shm_node_array<Edge>>(m_comm, local_slice);
+    double share_end = MPI_Wtime();
+    m_comm.cout0("node-shared slice setup time: ", share_end - share_start);
+}
+
+inline std::pair<const Edge*, const Edge*> Sorted_COO::node_row_range(int owner_rank, int row) const{
+    const Edge *slice_begin = node_slices->slice_begin(owner_rank);
+    const Edge *slice_end = node_slices->slice_end(owner_rank);
+    auto comp_row = [](const Edge &lhs, int val){
+        return lhs.row < val;
+    };
+    const Edge *begin = std::lower_bound(slice_begin, slice_end, row, comp_row);
+    const Edge *end = begin;
+    while(end != slice_end && end->row == row){
+        end++;
+    }
+    return {begin, end};
+}
+
+inline const Edge* Sorted_COO::first_product_edge(const Edge *begin, const Edge *end, int out_row) const{
+    if(!upper_triangle){
+        return begin;
+    }
+    return std::lower_bound(begin, end, out_row, [](const Edge &lhs, int val){
+        return lhs.col < val;
+    });
+}
+
+template <class Matrix>
+inline std::vector<Edge> Sorted_COO::row_owned_product(Matrix &unsorted_matrix, const spgemm_options &opts){
+    // rows of C are the rows of A, split into equal ranges over the ranks
+    int local_max_row = -1;
+    unsorted_matrix.local_for_all([&local_max_row](int index, Edge &ed){
+        local_max_row = std::max(local_max_row, ed.row);
+    });
+    int num_rows = ygm::max(local_max_row, m_comm) + 1;
+
+    flat_accumulator<map_key, int> row_owned_C(m_comm);
+    row_owned_C.partition_rows(num_rows);
+    spGemm(unsorted_matrix, row_owned_C, opts);
+    m_comm.barrier();
+
+    std::vector<Edge> local_edges;
+    local_edges.reserve(row_owned_C.local_size());
+    row_owned_C.local_for_all([&local_edges](const map_key &key, int value){
+        local_edges.push_back({key.x, key.y, value});
+    });
+    row_owned_C.local_clear();
+    std::sort(local_edges.begin(), local_edges.end());
+    return local_edges;
+}
+
+template <class Matrix>
+inline std::unique_ptr<Sorted_COO> Sorted_COO::spGemm_to_sorted(Matrix &unsorted_matrix, const spgemm_options &opts){
+    std::vector<Edge> local_edges = row_owned_product(unsorted_matrix, opts);
+
+    double build_start = MPI_Wtime();
+    auto product = std::make_unique<Sorted_COO>(m_comm, build_sorted_array(m_comm, local_edges));
+    double build_end = MPI_Wtime();
+    m_comm.cout0("row-sorted output construction time: ", build_end - build_start);
+    return product;
+}
+
+template <class Matrix>
+inline std::unique_ptr<Sorted_COO> Sorted_COO::spGemm_pruned(Matrix &unsorted_matrix, const prune_options &prune,
+                                                             const spgemm_options &opts){
+    std::vector<Edge> local_edges = row_owned_product(unsorted_matrix, opts);
+
+    double prune_start = MPI_Wtime();
+    size_t before = ygm::sum(local_edges.size(), m_comm);
+    prune_rows(local_edges, prune);
+    size_t after = ygm::sum(local_edges.size(), m_comm);
+    auto product = std::make_unique<Sorted_COO>(m_comm, build_sorted_array(m_comm, local_edges));
+    double prune_end = MPI_Wtime();
+    m_comm.cout0("pruned C from ", before, " to ", after, " entries, pruning and construction time: ",
+                 prune_end - prune_start);
+    return product;
+}
+
+template <class Matrix>
+inline std::vector<scored_pair> Sorted_COO::similarity(Matrix &unsorted_matrix, dense_matrix<double> &degrees,
+                                                       similarity_measure measure){
+    merge_delta();
+    double similarity_start = MPI_Wtime();
+    int local_max_row = -1;
+    unsorted_matrix.local_for_all([&local_max_row](int index, Edge &ed){
+        local_max_row = std::max(local_max_row, ed.row);
+    });
+    int num_rows = ygm::max(local_max_row, m_comm) + 1;
+
+    // Adamic-Adar weight of every local row w of B, from the degree of w
+    std::vector<int> local_row_ids;
+    if(measure == similarity_measure::adamic_adar){
+        sorted_matrix.local_for_all([&local_row_ids](int index, Edge &ed){
+            if(local_row_ids.empty() || local_row_ids.back() != ed.row){
+                local_row_ids.push_back(ed.row);
+            }
+        });
+    }
+    std::vector<double> row_degrees = gather_dense_rows(degrees, local_row_ids);
+    boost::unordered_flat_map<int, double> row_weights;
+    for(size_t i = 0; i < local_row_ids.size(); i++){
+        row_weights[local_row_ids[i]] = row_degrees[i] > 1 ? 1.0 / std::log(row_degrees[i]) : 0.0;
+    }
+    auto weights_ptr = m_comm.make_ygm_ptr(row_weights);
+
+    flat_accumulator<map_key, double> pair_sums(m_comm);
+    pair_sums.partition_rows(num_rows);
+    auto pair_sums_ptr = m_comm.make_ygm_ptr(pair_sums);
+    m_comm.barrier();
+
+    // pairs the incoming (i, w) entry with every j of the local part of row w
+    auto pair_up = [](auto paccum, auto self, auto pweights, int input_value, int input_row, int input_column){
+        auto adder = [](const map_key &key, double &sum, double to_add){
+            sum += to_add;
+        };
+        double weight = input_value;
+        if(!pweights->empty()){
+            auto found = pweights->find(input_column);
+            weight *= found == pweights->end() ? 0.0 : found->second;
+            if(weight == 0){
+                return;
+            }
+        }
+        auto [low, upper_bound] = self->local_rows.row_segment(input_column);
+        const int *cols = self->local_rows.cols();
+        const int *values = self->local_rows.values();
+        for(size_t e = low; e < upper_bound; e++){
+            if(cols[e] != input_row && values[e] != 0){
+                paccum->async_visit({input_row, cols[e]}, adder, weight * values[e]);
+            }
+        }
+    };
+    unsorted_matrix.local_for_all([&](int index, Edge &ed){
+        int input_column = ed.col;
+        int input_row = ed.row;
+        int input_value = ed.value;
+        async_visit_row(input_column, pair_up, pair_sums_ptr, pthis, weights_ptr, input_value, input_row, input_column);
+    });
+    m_comm.barrier();
+    double multiply_end = MPI_Wtime();
+
+    std::vector<scored_pair> pairs;
+    pairs.reserve(pair_sums.local_size());
+    pair_sums.local_for_all([&pairs](const map_key &key, double sum){
+        pairs.push_back({key.x, key.y, sum});
+    });
+    pair_sums.local_clear();
+    std::sort(pairs.begin(), pairs.end(), [](const scored_pair &lhs, const scored_pair &rhs){
+        return lhs.row != rhs.row ? lhs.row < rhs.row : lhs.col < rhs.col;
+    });
+
+    // Jaccard and cosine need d(i) and d(j) of every local pair
+    std::vector<int> vertices;
+    if(measure == similarity_measure::jaccard || measure == similarity_measure::cosine){
+        vertices.reserve(2 * pairs.size());
+        for(const scored_pair &pair : pairs){
+            vertices.push_back(pair.row);
+            vertices.push_back(pair.col);
+        }
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    }
+    std::vector<double> vertex_degrees = gather_dense_rows(degrees, vertices);
+    auto degree_of = [&](int vertex){
+        return vertex_degrees[std::lower_bound(vertices.begin(), vertices.end(), vertex) - vertices.begin()];
+    };
+    if(!vertices.empty()){
+        for(scored_pair &pair : pairs){
+            double di = degree_of(pair.row);
+            double dj = degree_of(pair.col);
+            if(measure == similarity_measure::jaccard){
+                double union_size = di + dj - pair.score;
+                pair.score = union_size > 0 ? pair.score / union_size : 0.0;
+            }
+            else{
+                pair.score = di > 0 && dj > 0 ? pair.score / std::sqrt(di * dj) : 0.0;
+            }
+        }
+    }
+    double similarity_end = MPI_Wtime();
+    m_comm.cout0("similarity: ", ygm::sum(pairs.size(), m_comm), " pairs, multiply time: ",
+                 multiply_end - similarity_start, ", normalization time: ", similarity_end - multiply_end);
+    return pairs;
+}
+
+inline int Sorted_COO::delta_owner(int row) const{
+    return int(uint32_t(row) % uint32_t(m_comm.size()));
+}
+
+inline void Sorted_COO::add_delta(const std::vector<Edge> &local_edges){
+    auto receive_delta = [](auto self, const std::vector<Edge> &edges){
+        self->pending_delta.insert(self->pending_delta.end(), edges.begin(), edges.end());
+    };
+    constexpr size_t batch_edges = 4096;
+    std::vector<std::vector<Edge>> outgoing(m_comm.size());
+    for(const Edge &ed : local_edges){
+        YGM_ASSERT_RELEASE(ed.row >= 0 && ed.col >= 0);
+        int dest = delta_owner(ed.row);
+        outgoing[dest].push_back(ed);
+        if(outgoing[dest].size() >= batch_edges){
+            m_comm.async(dest, receive_delta, pthis, outgoing[dest]);
+            outgoing[dest].clear();
+        }
+    }
+    for(int dest = 0; dest < m_comm.size(); dest++){
+        if(!outgoing[dest].empty()){
+            m_comm.async(dest, receive_delta, pthis, outgoing[dest]);
+        }
+    }
+    m_comm.barrier();
+
+    radix_sort(pending_delta, [](const Edge &ed){
+        return pack_key({ed.row, ed.col});
+    });
+    pending_rows.clear();
+    for(const Edge &ed : pending_delta){
+        pending_rows.push_back(ed.row, ed.col, ed.value);
+    }
+    pending_rows.finish();
+}
+
+inline void Sorted_COO::apply_pending_delta(){
+    size_t applied = ygm::sum(pending_delta.size(), m_comm);
+    std::vector<Edge> merged;
+    merged.reserve(delta_edges.size() + pending_delta.size());
+    std::merge(delta_edges.begin(), delta_edges.end(), pending_delta.begin(), pending_delta.end(),
+               std::back_inserter(merged), [](const Edge &lhs, const Edge &rhs){
+        return lhs.row != rhs.row ? lhs.row < rhs.row : lhs.col < rhs.col;
+    });
+    delta_edges.swap(merged);
+    delta_rows.clear();
+    for(const Edge &ed : delta_edges){
+        delta_rows.push_back(ed.row, ed.col, ed.value);
+    }
+    delta_rows.finish();
+    pending_delta.clear();
+    pending_rows.clear();
+    delta_total += applied;
+}
+
+template <class Accumulator>
+inline void Sorted_COO::spGemm_update(Sorted_COO &transposed_A, Accumulator &partial_accum, const spgemm_options &opts){
+    double update_start = MPI_Wtime();
+    Sorted_COO &At = transposed_A;
+    bool same_operand = &At == this;
+    size_t delta_B = ygm::sum(pending_delta.size(), m_comm);
+    size_t delta_A = same_operand ? delta_B : ygm::sum(At.pending_delta.size(), m_comm);
+    // B rows gain entries in the side buffer from dB; with dB empty only the applied side buffer can match
+    bool visit_B_delta = delta_B > 0 || delta_total > 0;
+    bool visit_A_delta = At.delta_total > 0;
+    bool upper = opts.upper_triangle;
+
+    /*
+        C row out_row += scalar * (one column-sorted row segment), and C column out_col += scalar * (one
+        segment of A^T), in upper-triangle mode only the entries with row <= col.
+    */
+    auto scale_into_row = [](auto pmap, bool upper, const csr_slice &rows, int segment_row, int scalar, int out_row){
+        auto adder = [](const auto &key, auto &partial_product, auto to_add){
+            partial_product += to_add;
+        };
+        auto [low, high] = rows.row_segment(segment_row);
+        const int *cols = rows.cols();
+        if(upper){
+            low = std::lower_bound(cols + low, cols + high, out_row) - cols;
+        }
+        for(size_t e = low; e < high; e++){
+            int product = scalar * rows.values()[e];
+            if(product != 0){
+                pmap->async_visit({out_row, cols[e]}, adder, product);
+            }
+        }
+    };
+    auto scale_into_col = [](auto pmap, bool upper, const csr_slice &rows, int segment_row, int scalar, int out_col){
+        auto adder = [](const auto &key, auto &partial_product, auto to_add){
+            partial_product += to_add;
+        };
+        auto [low, high] = rows.row_segment(segment_row);
+        const int *cols = rows.cols();
+        if(upper){
+            high = std::upper_bound(cols + low, cols + high, out_col) - cols;
+        }
+        for(size_t e = low; e < high; e++){
+            int product = scalar * rows.values()[e];
+            if(product != 0){
+                pmap->async_visit({cols[e], out_col}, adder, product);
+            }
+        }
+    };
+
+    // dA * (B + dB): on the array owners of row w of B, and on its delta owner for the side buffer and dB
+    auto multiply_B = [scale_into_row](auto pmap, auto self, bool upper, int input_value, int input_row, int input_column){
+        scale_into_row(pmap, upper, self->local_rows, input_column, input_value, input_row);
+    };
+    auto multiply_B_delta = [scale_into_row](auto pmap, auto self, bool upper, int input_value, int input_row, int input_column){
+        scale_into_row(pmap, upper, self->delta_rows, input_column, input_value, input_row);
+        scale_into_row(pmap, upper, self->pending_rows, input_column, input_value, input_row);
+    };
+    // A * dB: on the array owners of row w of A^T, and on its delta owner for the side buffer (not dA)
+    auto multiply_A = [scale_into_col](auto pmap, auto self, bool upper, int input_value, int input_col, int input_row){
+        scale_into_col(pmap, upper, self->local_rows, input_row, input_value, input_col);
+    };
+    auto multiply_A_delta = [scale_into_col](auto pmap, auto self, bool upper, int input_value, int input_col, int input_row){
+        scale_into_col(pmap, upper, self->delta_rows, input_row, input_value, input_col);
+    };
+
+    ygm::ygm_ptr<Accumulator> pmap(&partial_accum);
+    m_comm.barrier();
+    for(const Edge &ed : At.pending_delta){
+        // ed is (w, i) of dA^T, i.e. dA(i, w)
+        int input_column = ed.row;
+        int input_row = ed.col;
+        int input_value = ed.value;
+        async_visit_row(input_column, multiply_B, pmap, pthis, upper, input_value, input_row, input_column);
+        if(visit_B_delta){
+            route(delta_owner(input_column), multiply_B_delta, pmap, pthis, upper, input_value, input_row, input_column);
+        }
+    }
+    for(const Edge &ed : pending_delta){
+        // ed is dB(w, j)
+        int input_row = ed.row;
+        int input_col = ed.col;
+        int input_value = ed.value;
+        At.async_visit_row(input_row, multiply_A, pmap, At.pthis, upper, input_value, input_col, input_row);
+        if(visit_A_delta){
+            At.route(At.delta_owner(input_row), multiply_A_delta, pmap, At.pthis, upper, input_value, input_col, input_row);
+        }
+    }
+    m_comm.barrier();
+    double multiply_end = MPI_Wtime();
+
+    apply_pending_delta();
+    if(!same_operand){
+        At.apply_pending_delta();
+    }
+    // the side buffer is only a stopgap: once it is large, one merge costs less than the extra lookups
+    constexpr size_t merge_fraction = 16;
+    if(delta_total * merge_fraction > sorted_matrix.size()){
+        merge_delta();
+    }
+    if(!same_operand && At.delta_total * merge_fraction > At.sorted_matrix.size()){
+        At.merge_delta();
+    }
+    double update_end = MPI_Wtime();
+    m_comm.cout0("incremental update with ", delta_A, " new A and ", delta_B, " new B entries, multiply time: ",
+                 multiply_end - update_start, ", total: ", update_end - update_start);
+}
+
+inline void Sorted_COO::merge_delta(){
+    if(delta_total == 0){
+        return;
+    }
+    double merge_start = MPI_Wtime();
+    std::vector<Edge> local_edges = local_slice();
+    local_edges.insert(local_edges.end(), delta_edges.begin(), delta_edges.end());
+    size_t total = ygm::sum(local_edges.size(), m_comm);
+    size_t offset = ygm::prefix_sum(local_edges.size(), m_comm);
+    m_comm.barrier();
+    sorted_matrix.resize(total);
+    write_edge_runs(m_comm, sorted_matrix, local_edges, offset);
+    local_edges.clear();
+    local_edges.shrink_to_fit();
+    sort_edges(m_comm, sorted_matrix);
+
+    delta_edges.clear();
+    delta_rows.clear();
+    delta_total = 0;
+    bool had_owner_table = !owner_table.empty();
+    build_row_owners();
+    if(had_owner_table){
+        build_owner_table();
+    }
+    if(!hub_rows.empty()){
+        replicate_hub_rows(hub_rows.size());
+    }
+    if(node_slices){
+        node_slices->release();
+        node_slices.reset();
+    }
+    double merge_end = MPI_Wtime();
+    m_comm.cout0("merged the delta side buffer into B (", sorted_matrix.size(), " entries) in ", merge_end - merge_start);
+}
+
+inline void Sorted_COO::prune_rows(std::vector<Edge> &rows, const prune_options &prune){
+    auto abs_value = [](const Edge &ed){
+        return ed.value < 0 ? -int64_t(ed.value) : int64_t(ed.value);
+    };
+
+    // per row: the row_top_k largest values, then the absolute threshold. Rows are runs of the sorted vector.
+    size_t out = 0;
+    std::vector<Edge> row;
+    for(size_t begin = 0; begin < rows.size(); ){
+        size_t end = begin;
+        while(end < rows.size() && rows[end].row == rows[begin].row){
+            end++;
+        }
+        row.assign(rows.begin() + begin, rows.begin() + end);
+        if(prune.row_top_k > 0 && row.size() > prune.row_top_k){
+            std::nth_element(row.begin(), row.begin() + prune.row_top_k, row.end(), [](const Edge &lhs, const Edge &rhs){
+                return lhs.value != rhs.value ? lhs.value > rhs.value : lhs.col < rhs.col;
+            });
+            row.resize(prune.row_top_k);
+            std::sort(row.begin(), row.end());
+        }
+        for(const Edge &ed : row){
+            if(abs_value(ed) >= prune.min_abs_value){
+                rows[out++] = ed;
+            }
+        }
+        begin = end;
+    }
+    rows.resize(out);
+
+    if(prune.max_nnz == 0 || ygm::sum(rows.size(), m_comm) <= prune.max_nnz){
+        return;
+    }
+    /*
+        Global budget: the smallest threshold t with at most max_nnz entries of |value| >= t, found by a
+        binary search over the value range with one collective count per step. Entries tied at the cut are
+        all dropped, so C may end up with fewer than max_nnz entries.
+    */
+    int64_t local_max = 0;
+    for(const Edge &ed : rows){
+        local_max = std::max(local_max, abs_value(ed));
+    }
+    int64_t low = 1;
+    int64_t high = ygm::max(local_max, m_comm) + 1;   // count(|value| >= high) == 0 <= max_nnz
+    while(low < high){
+        int64_t mid = low + (high - low) / 2;
+        size_t local_count = std::count_if(rows.begin(), rows.end(), [&](const Edge &ed){
+            return abs_value(ed) >= mid;
+        });
+        if(ygm::sum(local_count, m_comm) <= prune.max_nnz){
+            high = mid;
+        }
+        else{
+            low = mid + 1;
+        }
+    }
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [&](const Edge &ed){
+        return abs_value(ed) < low;
+    }), rows.end());
+}
+
+inline std::unique_ptr<ygm::container::array<Edge>> build_sorted_array(ygm::comm &c, const std::vector<Edge> &local_edges){
+    size_t local_count = local_edges.size();
+    size_t total = ygm::sum(local_count, c);
+    size_t offset = ygm::prefix_sum(local_count, c);
+
+    auto arr = std::make_unique<ygm::container::array<Edge>>(c, total);
+    write_edge_runs(c, *arr, local_edges, offset);
+    return arr;
+}
+
+inline std::unique_ptr<ygm::container::array<Edge>> transpose_edges(ygm::comm &c, ygm::container::array<Edge> &src,
+                                                                    std::vector<std::pair<int, size_t>> *row_degrees){
+    double transpose_start = MPI_Wtime();
+    int local_max_col = -1;
+    src.local_for_all([&local_max_col](int index, Edge &ed){
+        local_max_col = std::max(local_max_col, ed.col);
+    });
+    int num_rows = ygm::max(local_max_col, c) + 1;
+    int rows_per_rank = std::max(1, (num_rows + c.size() - 1) / c.size());
+
+    std::vector<Edge> inbox;
+    auto inbox_ptr = c.make_ygm_ptr(inbox);
+    auto receive = [](auto pinbox, const std::vector<Edge> &batch){
+        pinbox->insert(pinbox->end(), batch.begin(), batch.end());
+    };
+    constexpr size_t batch_size = 1 << 16;
+    std::vector<std::vector<Edge>> outgoing(c.size());
+    src.local_for_all([&](int index, Edge &ed){
+        Edge swapped = {ed.col, ed.row, ed.value};
+        int dest = std::min(swapped.row / rows_per_rank, c.size() - 1);
+        if(dest == c.rank()){
+            inbox.push_back(swapped);
+            return;
+        }
+        outgoing[dest].push_back(swapped);
+        if(outgoing[dest].size() >= batch_size){
+            c.async(dest, receive, inbox_ptr, outgoing[dest]);
+            outgoing[dest].clear();
+        }
+    });
+    for(int dest = 0; dest < c.size(); dest++){
+        if(!outgoing[dest].empty()){
+            c.async(dest, receive, inbox_ptr, outgoing[dest]);
+        }
+    }
+    outgoing.clear();
+    c.barrier();
+
+    radix_sort(inbox, [](const Edge &ed){
+        return pack_key({ed.row, ed.col});
+    });
+    if(row_degrees){
+        row_degrees->clear();
+        for(size_t i = 0; i < inbox.size(); ){
+            size_t j = i;
+            while(j < inbox.size() && inbox[j].row == inbox[i].row){
+                j++;
+            }
+            row_degrees->push_back({inbox[i].row, j - i});
+            i = j;
+        }
+    }
+    auto transposed = build_sorted_array(c, inbox);
+    double transpose_end = MPI_Wtime();
+    c.cout0("transpose time: ", transpose_end - transpose_start);
+    return transposed;
+}
+
+inline void sort_edges(ygm::comm &c, ygm::container::array<Edge> &arr){
+    auto edge_key = [](const Edge &ed){
+        return pack_key({ed.row, ed.col});
+    };
+    std::vector<Edge> local_edges;
+    local_edges.reserve(arr.local_size());
+    arr.local_for_all([&local_edges](int index, Edge &ed){
+        local_edges.push_back(ed);
+    });
+    radix_sort(local_edges, edge_key);
+
+    /*
+        Splitters: regular samples of every rank's sorted keys are sorted on rank 0, which picks size - 1 of
+        them and broadcasts them.
+    */
+    constexpr size_t samples_per_rank = 64;
+    std::vector<uint64_t> samples;
+    std::vector<uint64_t> splitters;
+    auto samples_ptr = c.make_ygm_ptr(samples);
+    auto splitters_ptr = c.make_ygm_ptr(splitters);
+    if(!local_edges.empty()){
+        std::vector<uint64_t> local_samples;
+        size_t count = std::min(samples_per_rank, local_edges.size());
+        for(size_t i = 0; i < count; i++){
+            local_samples.push_back(edge_key(local_edges[i * local_edges.size() / count]));
+        }
+        auto add_samples = [](auto psamples, const std::vector<uint64_t> &keys){
+            psamples->insert(psamples->end(), keys.begin(), keys.end());
+        };
+        c.async(0, add_samples, samples_ptr, local_samples);
+    }
+    c.barrier();
+    if(c.rank0()){
+        std::sort(samples.begin(), samples.end());
+        size_t share = samples.size() / c.size();
+        for(int rank = 1; rank < c.size() && !samples.empty(); rank++){
+            uint64_t splitter = samples[rank * samples.size() / c.size()];
+            uint64_t row_start = splitter & ~uint64_t(0xffffffff);
+            auto row_begin = std::lower_bound(samples.begin(), samples.end(), row_start);
+            auto row_end = std::lower_bound(samples.begin(), samples.end(), row_start + (uint64_t(1) << 32));
+            if(size_t(row_end - row_begin) <= share){
+                splitter = row_start;   // keep the row in one bucket
+            }
+            splitters.push_back(std::max(splitter, splitters.empty() ? 0 : splitters.back()));
+        }
+        auto set_splitters = [](auto psplitters, const std::vector<uint64_t> &keys){
+            *psplitters = keys;
+        };
+        c.async_bcast(set_splitters, splitters_ptr, splitters);
+    }
+    c.barrier();
+
+    // bucket "rank" gets the keys in [splitters[rank - 1], splitters[rank])
+    std::vector<Edge> inbox;
+    auto inbox_ptr = c.make_ygm_ptr(inbox);
+    auto receive = [](auto pinbox, const std::vector<Edge> &batch){
+        pinbox->insert(pinbox->end(), batch.begin(), batch.end());
+    };
+    constexpr size_t batch_size = 1 << 16;
+    std::vector<Edge> batch;
+    int dest = 0;
+    auto send = [&](){
+        if(dest == c.rank()){
+            inbox.insert(inbox.end(), batch.begin(), batch.end());
+        }
+        else if(!batch.empty()){
+            c.async(dest, receive, inbox_ptr, batch);
+        }
+        batch.clear();
+    };
+    for(const Edge &ed : local_edges){
+        uint64_t key = edge_key(ed);
+        while(dest < int(splitters.size()) && key >= splitters[dest]){
+            send();
+            dest++;
+        }
+        batch.push_back(ed);
+        if(batch.size() >= batch_size){
+            send();
+        }
+    }
+    send();
+    local_edges = {};
+    c.barrier();
+    radix_sort(inbox, edge_key);
+
+    /*
+        Write back: the buckets are in rank order, so this rank's elements go to the global indices
+        [offset, offset + inbox.size()).
+    */
+    write_edge_runs(c, arr, inbox, ygm::prefix_sum(inbox.size(), c));
+}
+
+inline void write_edge_runs(ygm::comm &c, ygm::container::array<Edge> &arr, const std::vector<Edge> &local_edges,
+                            size_t offset){
+    // the global index of the first element of every rank's block
+    std::vector<size_t> starts(c.size(), 0);
+    auto starts_ptr = c.make_ygm_ptr(starts);
+    auto set_start = [](auto pstarts, int rank, size_t start){
+        (*pstarts)[rank] = start;
+    };
+    c.async(0, set_start, starts_ptr, c.rank(), ygm::prefix_sum(arr.local_size(), c));
+    c.barrier();
+    if(c.rank0()){
+        auto set_starts = [](auto pstarts, const std::vector<size_t> &table){
+            *pstarts = table;
+        };
+        c.async_bcast(set_starts, starts_ptr, starts);
+    }
+    c.barrier();
+
+    constexpr size_t batch_size = 1 << 16;
+    std::vector<std::pair<size_t, std::vector<Edge>>> runs;
+    auto runs_ptr = c.make_ygm_ptr(runs);
+    auto receive_run = [](auto pruns, size_t first, const std::vector<Edge> &run){
+        pruns->push_back({first, run});
+    };
+    for(size_t i = 0; i < local_edges.size(); ){
+        size_t index = offset + i;
+        int owner = std::upper_bound(starts.begin(), starts.end(), index) - starts.begin() - 1;
+        size_t owner_end = owner + 1 < c.size() ? starts[owner + 1] : offset + local_edges.size();
+        size_t length = std::min({local_edges.size() - i, owner_end - index, batch_size});
+        std::vector<Edge> run(local_edges.begin() + i, local_edges.begin() + i + length);
+        if(owner == c.rank()){
+            runs.push_back({index, std::move(run)});
+        }
+        else{
+            c.async(owner, receive_run, runs_ptr, index, run);
+        }
+        i += length;
+    }
+    c.barrier();
+    for(auto &[first, run] : runs){
+        for(size_t i = 0; i < run.size(); i++){
+            arr.local_visit(first + i, [&run, i](int index, Edge &ed){
+                ed = run[i];
+            });
+        }
+    }
+    c.barrier();
+}
+
+inline std::unique_ptr<Sorted_COO> Sorted_COO::transpose(std::vector<std::pair<int, size_t>> *row_degrees){
+    merge_delta();
+    return std::make_unique<Sorted_COO>(m_comm, transpose_edges(m_comm, sorted_matrix, row_degrees));
+}
+
+inline std::vector<Edge> Sorted_COO::local_slice(){
+    std::vector<Edge> slice;
+    slice.reserve(sorted_matrix.local_size());
+    sorted_matrix.local_for_all([&slice](int index, Edge &ed){
+        slice.push_back(ed);
+    });
+    return slice;
+}
+
+template <typename T>
+inline void Sorted_COO::add_dense_rows(dense_matrix<T> &Y, const std::vector<int> &rows, const std::vector<T> &values){
+    int width = Y.width();
+    auto add_rows = [](auto pY, const std::vector<int> &rows, const std::vector<T> &values){
+        int width = pY->width();
+        for(size_t i = 0; i < rows.size(); i++){
+            dense_matrix<T>::axpy(pY->local_row(rows[i]), T(1), values.data() + i * width, width);
+        }
+    };
+    constexpr size_t batch_rows = 4096;
+    std::vector<std::vector<int>> outgoing_rows(m_comm.size());
+    std::vector<std::vector<T>> outgoing_values(m_comm.size());
+    for(size_t i = 0; i < rows.size(); i++){
+        const T *row_values = values.data() + i * width;
+        int dest = Y.owner(rows[i]);
+        if(dest == m_comm.rank()){
+            dense_matrix<T>::axpy(Y.local_row(rows[i]), T(1), row_values, width);
+            continue;
+        }
+        outgoing_rows[dest].push_back(rows[i]);
+        outgoing_values[dest].insert(outgoing_values[dest].end(), row_values, row_values + width);
+        if(outgoing_rows[dest].size() >= batch_rows){
+            route(dest, add_rows, Y.get_ygm_ptr(), outgoing_rows[dest], outgoing_values[dest]);
+            outgoing_rows[dest].clear();
+            outgoing_values[dest].clear();
+        }
+    }
+    for(int dest = 0; dest < m_comm.size(); dest++){
+        if(!outgoing_rows[dest].empty()){
+            route(dest, add_rows, Y.get_ygm_ptr(), outgoing_rows[dest], outgoing_values[dest]);
+        }
+    }
+}
+
+template <typename T>
+inline std::vector<T> Sorted_COO::gather_dense_rows(dense_matrix<T> &X, const std::vector<int> &rows){
+    /*
+        The sorted row list splits into one contiguous run per X owner, and each reply is copied straight
+        to its run's place in "gathered".
+    */
+    int width = X.width();
+    std::vector<T> gathered(rows.size() * width);
+    auto gathered_ptr = m_comm.make_ygm_ptr(gathered);
+    auto serve_rows = [](auto pX, auto pgathered, int requester, size_t offset, const std::vector<int> &batch){
+        int width = pX->width();
+        std::vector<T> data(batch.size() * width);
+        for(size_t i = 0; i < batch.size(); i++){
+            const T *row_values = pX->local_row(batch[i]);
+            std::copy(row_values, row_values + width, data.begin() + i * width);
+        }
+        auto deliver = [](auto pgathered, size_t offset, const std::vector<T> &data){
+            std::copy(data.begin(), data.end(), pgathered->begin() + offset);
+        };
+        pX->comm().async(requester, deliver, pgathered, offset, data);
+    };
+    constexpr size_t batch_rows = 4096;
+    for(size_t begin = 0; begin < rows.size(); ){
+        int owner_rank = X.owner(rows[begin]);
+        size_t end = begin;
+        while(end < rows.size() && end - begin < batch_rows && X.owner(rows[end]) == owner_rank){
+            end++;
+        }
+        if(owner_rank == m_comm.rank()){
+            for(size_t i = begin; i < end; i++){
+                const T *row_values = X.local_row(rows[i]);
+                std::copy(row_values, row_values + width, gathered.begin() + i * width);
+            }
+        }
+        else{
+            std::vector<int> batch(rows.begin() + begin, rows.begin() + end);
+            m_comm.async(owner_rank, serve_rows, X.get_ygm_ptr(), gathered_ptr, m_comm.rank(), begin * width, batch);
+        }
+        begin = end;
+    }
+    m_comm.barrier();
+    return gathered;
+}
+
+template <typename T>
+inline void Sorted_COO::spmm(dense_matrix<T> &X, dense_matrix<T> &Y){
+    YGM_ASSERT_RELEASE(X.width() == Y.width());
+    merge_delta();
+    double spmm_start = MPI_Wtime();
+    int width = X.width();
+    const int *rows = local_rows.rows();
+    const size_t *offsets = local_rows.offsets();
+    const int *entry_cols = local_rows.cols();
+    const int *entry_values = local_rows.values();
+    Y.fill(T());
+
+    /*
+        Stage 1: gather the X rows of the distinct local columns. Walking the entries in column order gives
+        the distinct columns and, for every entry, the position of its column in "gathered" in one pass.
+    */
+    std::vector<size_t> order(local_rows.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [entry_cols](size_t lhs, size_t rhs){
+        return entry_cols[lhs] < entry_cols[rhs];
+    });
+    std::vector<int> cols;
+    std::vector<size_t> position(local_rows.size());
+    for(size_t e : order){
+        if(cols.empty() || cols.back() != entry_cols[e]){
+            cols.push_back(entry_cols[e]);
+        }
+        position[e] = cols.size() - 1;
+    }
+    order = {};
+    std::vector<T> gathered = gather_dense_rows(X, cols);
+    double gather_end = MPI_Wtime();
+
+    /*
+        Stage 2: multiply the local rows
+    */
+    std::vector<int> out_rows(rows, rows + local_rows.num_rows());
+    std::vector<T> out_values(out_rows.size() * width, T());
+    for(size_t r = 0; r < out_rows.size(); r++){
+        T *acc = out_values.data() + r * width;
+        for(size_t e = offsets[r]; e < offsets[r + 1]; e++){
+            dense_matrix<T>::axpy(acc, T(entry_values[e]), gathered.data() + position[e] * width, width);
+        }
+    }
+    double multiply_end = MPI_Wtime();
+
+    add_dense_rows(Y, out_rows, out_values);
+    m_comm.barrier();
+    double spmm_end = MPI_Wtime();
+    m_comm.cout0("spmm (width ", width, ") gather time: ", gather_end - spmm_start,
+                 ", multiply time: ", multiply_end - gather_end, ", total: ", spmm_end - spmm_start);
+}
+
+template <typename T>
+inline void Sorted_COO::spmv(dense_matrix<T> &x, dense_matrix<T> &y){
+    YGM_ASSERT_RELEASE(x.width() == 1);
+    spmm(x, y);
+}
+
+template <typename T>
+inline void Sorted_COO::spmm_transpose(dense_matrix<T> &X, dense_matrix<T> &Y){
+    YGM_ASSERT_RELEASE(X.width() == Y.width());
+    merge_delta();
+    double spmm_start = MPI_Wtime();
+    int width = X.width();
+    Y.fill(T());
+
+    /*
+        Stage 1: send every local X row to the owner(s) of the matching row of B.
+    */
+    std::pair<std::vector<int>, std::vector<T>> inbox;
+    auto inbox_ptr = m_comm.make_ygm_ptr(inbox);
+    auto receive_rows = [](auto pinbox, const std::vector<int> &rows, const std::vector<T> &values){
+        pinbox->first.insert(pinbox->first.end(), rows.begin(), rows.end());
+        pinbox->second.insert(pinbox->second.end(), values.begin(), values.end());
+    };
+    constexpr size_t batch_rows = 4096;
+    std::vector<std::vector<int>> outgoing_rows(m_comm.size());
+    std::vector<std::vector<T>> outgoing_values(m_comm.size());
+    X.local_for_all([&](size_t row, const T *row_values){
+        auto [first, last] = owner_range(row);
+        for(int owner_rank = first; owner_rank < last; owner_rank++){
+            if(owner_rank == m_comm.rank()){
+                inbox.first.push_back(row);
+                inbox.second.insert(inbox.second.end(), row_values, row_values + width);
+                continue;
+            }
+            outgoing_rows[owner_rank].push_back(row);
+            outgoing_values[owner_rank].insert(outgoing_values[owner_rank].end(), row_values, row_values + width);
+            if(outgoing_rows[owner_rank].size() >= batch_rows){
+                route(owner_rank, receive_rows, inbox_ptr, outgoing_rows[owner_rank], outgoing_values[owner_rank]);
+                outgoing_rows[owner_rank].clear();
+                outgoing_values[owner_rank].clear();
+            }
+        }
+    });
+    for(int owner_rank = 0; owner_rank < m_comm.size(); owner_rank++){
+        if(!outgoing_rows[owner_rank].empty()){
+            route(owner_rank, receive_rows, inbox_ptr, outgoing_rows[owner_rank], outgoing_values[owner_rank]);
+        }
+    }
+    m_comm.barrier();
+    double route_end = MPI_Wtime();
+
+    /*
+        Stage 2: scale the received rows by the local entries and sum them per column of B.
+    */
+    boost::unordered_flat_map<int, size_t> x_position;
+    for(size_t i = 0; i < inbox.first.size(); i++){
+        x_position[inbox.first[i]] = i;
+    }
+    boost::unordered_flat_map<int, size_t> y_position;
+    std::vector<int> out_rows;
+    std::vector<T> out_values;
+    const int *rows = local_rows.rows();
+    const size_t *offsets = local_rows.offsets();
+    const int *entry_cols = local_rows.cols();
+    const int *entry_values = local_rows.values();
+    for(size_t r = 0; r < local_rows.num_rows(); r++){
+        auto found = x_position.find(rows[r]);
+        if(found == x_position.end()){
+            continue;
+        }
+        const T *row_values = inbox.second.data() + found->second * width;
+        for(size_t e = offsets[r]; e < offsets[r + 1]; e++){
+            auto [it, inserted] = y_position.try_emplace(entry_cols[e], out_rows.size());
+            if(inserted){
+                out_rows.push_back(entry_cols[e]);
+                out_values.resize(out_values.size() + width, T());
+            }
+            dense_matrix<T>::axpy(out_values.data() + it->second * width, T(entry_values[e]), row_values, width);
+        }
+    }
+    double multiply_end = MPI_Wtime();
+
+    add_dense_rows(Y, out_rows, out_values);
+    m_comm.barrier();
+    double spmm_end = MPI_Wtime();
+    m_comm.cout0("spmm_transpose (width ", width, ") routing time: ", route_end - spmm_start,
+                 ", multiply time: ", multiply_end - route_end, ", total: ", spmm_end - spmm_start);
+}
+
+inline std::string snapshot_file_name(const std::string &prefix, int rank){
+    return prefix + "." + std::to_string(rank) + ".edges";
+}
+
+inline void save_edge_snapshot(ygm::comm &c, ygm::container::array<Edge> &arr, const std::string &prefix){
+    double save_start = MPI_Wtime();
+    std::vector<Edge> local_edges;
+    local_edges.reserve(arr.local_size());
+    arr.local_for_all([&local_edges](int index, Edge &ed){
+        local_edges.push_back(ed);
+    });
+
+    snapshot_header header;
+    header.num_ranks = c.size();
+    header.total = arr.size();
+    header.local_start = arr.partitioner.local_start();
+    header.local_count = local_edges.size();
+
+    std::ofstream out(snapshot_file_name(prefix, c.rank()), std::ios::binary | std::ios::trunc);
+    YGM_ASSERT_RELEASE(out.is_open() == true);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(local_edges.data()), local_edges.size() * sizeof(Edge));
+    out.close();
+    YGM_ASSERT_RELEASE(out.fail() == false);
+    c.barrier();
+    double save_end = MPI_Wtime();
+    c.cout0("snapshot write time: ", save_end - save_start);
+}
+
+inline std::unique_ptr<ygm::container::array<Edge>> load_edge_snapshot(ygm::comm &c, const std::string &prefix){
+    double load_start = MPI_Wtime();
+    auto read_header = [](std::ifstream &in){
+        snapshot_header header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        YGM_ASSERT_RELEASE(in.good() == true);
+        YGM_ASSERT_RELEASE(header.magic == snapshot_header::expected_magic);
+        YGM_ASSERT_RELEASE(header.version == snapshot_header::current_version);
+        return header;
+    };
+    std::ifstream first_file(snapshot_file_name(prefix, 0), std::ios::binary);
+    YGM_ASSERT_RELEASE(first_file.is_open() == true);
+    snapshot_header first = read_header(first_file);
+    first_file.close();
+
+    auto arr = std::make_unique<ygm::container::array<Edge>>(c, first.total);
+    size_t local_begin = arr->partitioner.local_start();
+    size_t local_end = local_begin + arr->partitioner.local_size();
+
+    constexpr size_t chunk_size = 1 << 20;
+    std::vector<Edge> buffer;
+    for(int file = c.rank(); file < int(first.num_ranks); file += c.size()){
+        std::ifstream in(snapshot_file_name(prefix, file), std::ios::binary);
+        YGM_ASSERT_RELEASE(in.is_open() == true);
+        snapshot_header header = read_header(in);
+        YGM_ASSERT_RELEASE(header.num_ranks == first.num_ranks && header.total == first.total);
+        for(uint64_t done = 0; done < header.local_count; ){
+            size_t count = std::min<uint64_t>(chunk_size, header.local_count - done);
+            buffer.resize(count);
+            in.read(reinterpret_cast<char*>(buffer.data()), count * sizeof(Edge));
+            YGM_ASSERT_RELEASE(in.good() == true);
+            for(size_t i = 0; i < count; i++){
+                size_t index = header.local_start + done + i;
+                if(index >= local_begin && index < local_end){
+                    arr->local_visit(index, [&buffer, i](int index, Edge &ed){
+                        ed = buffer[i];
+                    });
+                }
+                else{
+                    arr->async_set(index, buffer[i]);
+                }
+            }
+            done += count;
+        }
+    }
+    c.barrier();
+    double load_end = MPI_Wtime();
+    c.cout0("snapshot read time: ", load_end - load_start, " (saved by ", first.num_ranks, " ranks)");
+    return arr;
+}
+
+inline void Sorted_COO::save_snapshot(const std::string &prefix){
+    merge_delta();
+    save_edge_snapshot(m_comm, sorted_matrix, prefix);
+    if(m_comm.rank0()){
+        auto write_pairs = [](std::ofstream &out, const std::vector<std::pair<int, int>> &pairs){
+            uint64_t count = pairs.size();
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            out.write(reinterpret_cast<const char*>(pairs.data()), count * sizeof(std::pair<int, int>));
+        };
+        std::ofstream meta(prefix + ".meta", std::ios::binary | std::ios::trunc);
+        YGM_ASSERT_RELEASE(meta.is_open() == true);
+        uint64_t magic = snapshot_header::expected_magic;
+        uint32_t version = snapshot_header::current_version;
+        uint32_t num_ranks = m_comm.size();
+        uint64_t saved_top_k = top_k;
+        meta.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        meta.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        meta.write(reinterpret_cast<const char*>(&num_ranks), sizeof(num_ranks));
+        meta.write(reinterpret_cast<const char*>(&saved_top_k), sizeof(saved_top_k));
+        write_pairs(meta, std::vector<std::pair<int, int>>(top_pairs.begin(), top_pairs.end()));
+        write_pairs(meta, row_owners);
+        uint64_t num_hubs = hub_rows.size();
+        uint8_t has_owner_table = !owner_table.empty();
+        meta.write(reinterpret_cast<const char*>(&num_hubs), sizeof(num_hubs));
+        meta.write(reinterpret_cast<const char*>(&has_owner_table), sizeof(has_owner_table));
+        meta.close();
+        YGM_ASSERT_RELEASE(meta.fail() == false);
+    }
+    m_comm.barrier();
+}
+
+inline std::unique_ptr<Sorted_COO> Sorted_COO::load_snapshot(ygm::comm &c, const std::string &prefix){
+    auto arr = load_edge_snapshot(c, prefix);
+
+    auto read_pairs = [](std::ifstream &in){
+        uint64_t count = 0;
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        std::vector<std::pair<int, int>> pairs(count);
+        in.read(reinterpret_cast<char*>(pairs.data()), count * sizeof(std::pair<int, int>));
+        return pairs;
+    };
+    std::ifstream meta(prefix + ".meta", std::ios::binary);
+    YGM_ASSERT_RELEASE(meta.is_open() == true);
+    uint64_t magic = 0;
+    uint32_t version = 0;
+    uint32_t num_ranks = 0;
+    uint64_t saved_top_k = 0;
+    meta.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    meta.read(reinterpret_cast<char*>(&version), sizeof(version));
+    meta.read(reinterpret_cast<char*>(&num_ranks), sizeof(num_ranks));
+    meta.read(reinterpret_cast<char*>(&saved_top_k), sizeof(saved_top_k));
+    YGM_ASSERT_RELEASE(magic == snapshot_header::expected_magic && version == snapshot_header::current_version);
+    std::vector<std::pair<int, int>> pairs = read_pairs(meta);
+    std::vector<std::pair<int, int>> owners = read_pairs(meta);
+    uint64_t num_hubs = 0;
+    uint8_t has_owner_table = 0;
+    meta.read(reinterpret_cast<char*>(&num_hubs), sizeof(num_hubs));
+    meta.read(reinterpret_cast<char*>(&has_owner_table), sizeof(has_owner_table));
+    YGM_ASSERT_RELEASE(meta.good() == true);
+
+    std::unique_ptr<Sorted_COO> coo;
+    if(int(num_ranks) == c.size()){
+        // same rank count and element count, so the array has the same block partitioning as when saved
+        coo.reset(new Sorted_COO(c, std::move(arr), std::move(owners)));
+    }
+    else{
+        coo = std::make_unique<Sorted_COO>(c, std::move(arr));
+    }
+    coo->top_k = saved_top_k;
+    coo->top_pairs.insert(pairs.begin(), pairs.end());
+    // the hub rows and owner table are derived from B, so they are rebuilt rather than stored
+    if(has_owner_table){
+        coo->build_owner_table();
+    }
+    if(num_hubs > 0){
+        coo->replicate_hub_rows(num_hubs);
+    }
+    return coo;
+}
+
+inline void Sorted_COO::set_top_pairs(size_t k, const std::vector<std::pair<int, size_t>> &top_rows,
+                                      const std::vector<std::pair<int, size_t>> &top_cols){
+    top_k = k;
+    top_pairs.clear();
+    for(size_t i = 0; i < std::min(k, top_rows.size()); i++){
+        for(size_t j = 0; j < std::min(k, top_cols.size()); j++){
+            top_pairs.insert({top_rows[i].first, top_cols[j].first});
+        }
+    }
+}
+
+template <class Matrix>
+inline tuned_config Sorted_COO::tune(Matrix &unsorted_matrix, const std::vector<std::pair<int, size_t>> &top_rows,
+                                     const std::vector<std::pair<int, size_t>> &top_cols, size_t samples_per_rank){
+    merge_delta();
+    double tune_start = MPI_Wtime();
+    const std::vector<size_t> k_candidates = {25, 50, 100, 200, 400};
+    const std::vector<size_t> hub_counts = {0, 10, 100, 1000};
+    // bytes per rank for the cache and its top pairs; small next to B and C on the graphs this runs on
+    constexpr size_t cache_budget = size_t(64) << 20;
+    // cache slot plus top_pairs entry
+    constexpr size_t bytes_per_top_pair = 32;
+    // the smallest top-k whose saved messages are within this share of the best one wins: the cache grows
+    // with k^2, the savings flatten out
+    constexpr double top_k_tolerance = 0.9;
+    // hub rows are copied to every rank, so their copy may take at most this share of a local slice
+    constexpr double hub_slice_share = 0.25;
+    // below this share of the row visits kept local, a hub copy costs more setup than it saves
+    constexpr double min_hub_visit_share = 0.01;
+    // batches per destination the A entries should fill, so the sends overlap with the multiply
+    constexpr size_t batches_per_dest = 4;
+    // message batch range: below 256 entries the per-message cost dominates, above 64K the sends stall
+    constexpr size_t min_batch_size = 256;
+    constexpr size_t max_batch_size = 65536;
+    // repeated (row, col) share of the products from which combining them before sending pays for the buffer
+    constexpr double min_duplicate_share = 0.1;
+    // combining buffer range, and products per rank per buffer entry; the buffer grows with the stream
+    constexpr size_t min_esc_entries = size_t(1) << 16;
+    constexpr size_t max_esc_entries = size_t(1) << 22;
+    constexpr size_t products_per_esc_entry = 64;
+
+    /*
+        Sample: every stride-th local A entry, so the counts below scale back by stride
+    */
+    size_t local_a_nnz = 0;
+    unsorted_matrix.local_for_all([&local_a_nnz](int index, Edge &ed){
+        local_a_nnz++;
+    });
+    size_t stride = std::max<size_t>(1, local_a_nnz / std::max<size_t>(1, samples_per_rank));
+    std::vector<Edge> sample;
+    size_t position = 0;
+    unsorted_matrix.local_for_all([&](int index, Edge &ed){
+        if(position++ % stride == 0){
+            sample.push_back(ed);
+        }
+    });
+
+    /*
+        Hub rows: a sampled A entry whose column is one of the top h rows of B is multiplied locally
+    */
+    std::vector<std::pair<int, size_t>> heavy_rows = top_row_degrees(hub_counts.back());
+    boost::unordered_flat_map<int, size_t> heavy_position;
+    for(size_t i = 0; i < heavy_rows.size(); i++){
+        heavy_position[heavy_rows[i].first] = i;
+    }
+    std::vector<double> local_hub_visits(hub_counts.size(), 0);
+    for(const Edge &ed : sample){
+        auto found = heavy_position.find(ed.col);
+        for(size_t c = 0; c < hub_counts.size(); c++){
+            if(found != heavy_position.end() && found->second < hub_counts[c]){
+                local_hub_visits[c] += stride;
+            }
+        }
+    }
+
+    /*
+        Product stream slice: the B owners replay what spGemm() would do with the sampled entries' products
+    */
+    struct tuning_state{
+        std::vector<size_t> ks;
+        std::vector<std::vector<uint64_t>> cache_slots;     // per candidate k: k * k slots, packed key + 1, 0 if empty
+        std::vector<size_t> cache_hits;
+        boost::unordered_flat_map<int, size_t> top_row_rank;  // position in top_rows / top_cols
+        boost::unordered_flat_map<int, size_t> top_col_rank;
+        boost::unordered_flat_set<uint64_t> distinct;
+        size_t products = 0;
+    };
+    tuning_state state;
+    for(size_t i = 0; i < top_rows.size(); i++){
+        state.top_row_rank[top_rows[i].first] = i;
+    }
+    for(size_t i = 0; i < top_cols.size(); i++){
+        state.top_col_rank[top_cols[i].first] = i;
+    }
+    for(size_t k : k_candidates){
+        state.ks.push_back(k);
+        state.cache_slots.emplace_back(k * k, 0);
+        state.cache_hits.push_back(0);
+    }
+    auto pstate = m_comm.make_ygm_ptr(state);
+
+    auto replay = [](auto self, auto pstate, int input_row, int input_value, int input_column){
+        tuning_state &st = *pstate;
+        auto [low, high] = self->local_rows.row_segment(input_column);
+        auto row_rank = st.top_row_rank.find(input_row);
+        for(size_t i = low; i < high; i++){
+            if(input_value * self->local_rows.values()[i] == 0){
+                continue;
+            }
+            map_key key = {input_row, self->local_rows.cols()[i]};
+            st.products++;
+            st.distinct.insert(pack_key(key));
+            if(row_rank == st.top_row_rank.end()){
+                continue;
+            }
+            auto col_rank = st.top_col_rank.find(key.y);
+            if(col_rank == st.top_col_rank.end()){
+                continue;
+            }
+            size_t pair_rank = std::max(row_rank->second, col_rank->second);
+            size_t hash = ygm::container::detail::hash<map_key>{}(key);
+            for(size_t c = 0; c < st.ks.size(); c++){
+                if(pair_rank >= st.ks[c]){
+                    continue;   // not a top pair for this k
+                }
+                uint64_t &slot = st.cache_slots[c][hash % st.cache_slots[c].size()];
+                if(slot == pack_key(key) + 1){
+                    st.cache_hits[c]++;
+                }
+                slot = pack_key(key) + 1;
+            }
+        }
+    };
+    for(const Edge &ed : sample){
+        async_visit_row(ed.col, replay, pthis, pstate, ed.row, ed.value, ed.col);
+    }
+    m_comm.barrier();
+
+    /*
+        Scale the sample back up and choose
+    */
+    double scale = double(stride);
+    double products = ygm::sum(state.products * scale, m_comm);
+    double a_nnz = ygm::sum(double(local_a_nnz), m_comm);
+    // a key produced on two ranks counts as distinct on both, so the global share is a lower bound
+    double sampled_products = ygm::sum(double(state.products), m_comm);
+    double sampled_distinct = ygm::sum(double(state.distinct.size()), m_comm);
+    double duplicate_share = sampled_products > 0 ? 1.0 - sampled_distinct / sampled_products : 0.0;
+    m_comm.cout0("tune: ", sample.size(), " sampled A entries on rank 0 (stride ", stride, "), about ",
+                 size_t(products), " products, ", size_t(a_nnz), " row visits");
+
+    tuned_config config;
+    std::vector<double> saved(k_candidates.size());
+    double best_saved = 0;
+    for(size_t c = 0; c < k_candidates.size(); c++){
+        saved[c] = ygm::sum(state.cache_hits[c] * scale, m_comm);
+        size_t bytes = k_candidates[c] * k_candidates[c] * bytes_per_top_pair;
+        m_comm.cout0("tune: top_k ", k_candidates[c], ": cache hit share ", products > 0 ? saved[c] / products : 0.0,
+                     ", C messages saved ~", size_t(saved[c]), ", ", bytes, " bytes per rank");
+        if(bytes <= cache_budget){
+            best_saved = std::max(best_saved, saved[c]);
+        }
+    }
+    config.top_k = k_candidates.front();
+    for(size_t c = 0; c < k_candidates.size(); c++){
+        if(k_candidates[c] * k_candidates[c] * bytes_per_top_pair <= cache_budget &&
+           saved[c] >= top_k_tolerance * best_saved){
+            config.top_k = k_candidates[c];
+            break;
+        }
+    }
+
+    double slice_bytes = double(sorted_matrix.size()) * sizeof(Edge) / m_comm.size();
+    config.num_hubs = 0;
+    size_t replicated_nnz = 0;
+    for(size_t c = 0; c < hub_counts.size(); c++){
+        for(size_t i = (c == 0 ? 0 : hub_counts[c - 1]); i < std::min(hub_counts[c], heavy_rows.size()); i++){
+            replicated_nnz += heavy_rows[i].second;
+        }
+        double kept_local = ygm::sum(local_hub_visits[c], m_comm);
+        double bytes = double(replicated_nnz) * sizeof(Edge);
+        m_comm.cout0("tune: ", hub_counts[c], " hub rows: ", a_nnz > 0 ? kept_local / a_nnz : 0.0,
+                     " of row visits local, ", size_t(bytes), " bytes per rank");
+        if(bytes <= hub_slice_share * slice_bytes && kept_local >= min_hub_visit_share * a_nnz){
+            config.num_hubs = hub_counts[c];
+        }
+    }
+
+    double visits_per_dest = a_nnz / m_comm.size() / m_comm.size();
+    size_t batch = min_batch_size;
+    while(batch < max_batch_size && batch * 2 <= visits_per_dest / batches_per_dest){
+        batch *= 2;
+    }
+    config.batch_size = batch;
+
+    // the sample only sees 1 / stride of the products, so repeats in it are a lower bound for the full stream
+    m_comm.cout0("tune: repeated (row, col) share in the sampled products ", duplicate_share);
+    config.esc_buffer_entries = 0;
+    if(duplicate_share >= min_duplicate_share){
+        size_t entries = min_esc_entries;
+        while(entries < max_esc_entries && entries * products_per_esc_entry < products / m_comm.size()){
+            entries *= 2;
+        }
+        config.esc_buffer_entries = entries;
+    }
+
+    double tune_end = MPI_Wtime();
+    m_comm.cout0("tuned: top_k ", config.top_k, ", num_hubs ", config.num_hubs, ", batch_size ", config.batch_size,
+                 ", esc_buffer_entries ", config.esc_buffer_entries, " in ", tune_end - tune_start);
+    return config;
+}
+
+inline void save_tuned_config(ygm::comm &c, const tuned_config &config, const std::string &path){
+    if(c.rank0()){
+        std::ofstream out(path, std::ios::trunc);
+        YGM_ASSERT_RELEASE(out.is_open() == true);
+        out << "top_k " << config.top_k << "\n"
+            << "num_hubs " << config.num_hubs << "\n"
+            << "batch_size " << config.batch_size << "\n"
+            << "esc_buffer_entries " << config.esc_buffer_entries << "\n";
+        out.close();
+        YGM_ASSERT_RELEASE(out.fail() == false);
+    }
+    c.barrier();
+}
+
+inline tuned_config load_tuned_config(const std::string &path){
+    std::ifstream in(path);
+    YGM_ASSERT_RELEASE(in.is_open() == true);
+    tuned_config config;
+    std::string name;
+    size_t value;
+    while(in >> name >> value){
+        if(name == "top_k"){
+            config.top_k = value;
+        }
+        else if(name == "num_hubs"){
+            config.num_hubs = value;
+        }
+        else if(name == "batch_size"){
+            config.batch_size = value;
+        }
+        else if(name == "esc_buffer_entries"){
+            config.esc_buffer_entries = value;
+        }
+    }
+    return config;
+}
+
 inline void Sorted_COO::print_row_owners(){
 }
 
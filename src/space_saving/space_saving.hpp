@@ -0,0 +1,141 @@
+#pragma once
+
+#include <ygm/comm.hpp>
+#include <ygm/detail/ygm_ptr.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+
+/*
+    Heavy-hitter sketch used in place of ygm::container::counting_set to find the top-k rows and columns.
+
+    Every rank counts its own stream (SpaceSaving with batched eviction): up to 2 * capacity keys are
+    counted exactly; when the table is full the capacity largest counters are kept, and the largest dropped
+    count becomes the floor that a newly seen key starts from. A kept key's count is never below its true
+    count and exceeds it by at most the floor, and every key seen more than stream length / capacity times
+    is kept. Nothing is sent while counting; gather_topk() sums the per-rank summaries once on rank 0.
+
+    The memory is bounded by the capacity, not by the number of distinct keys. When a rank sees fewer than
+    2 * capacity distinct keys its counts are exact, and so is the result.
+*/
+template <typename Key>
+class space_saving{
+
+public:
+    using self_type = space_saving<Key>;
+    using key_type = Key;
+
+    /**
+     * @brief constructor for the sketch. Must be called by all ranks.
+     *
+     * @param capacity : number of counters each rank keeps after an eviction (the table holds up to twice that)
+     */
+    explicit space_saving(ygm::comm &c, size_t capacity = 1 << 13) :
+                        m_comm(c),
+                        pthis(this),
+                        m_capacity(std::max<size_t>(1, capacity)){
+        pthis.check(m_comm);
+        m_counts.reserve(2 * m_capacity);
+    }
+
+    /*
+        @brief
+            counts one occurrence of key on this rank. Named like counting_set::async_insert() so the two can be
+            swapped, but no message is sent.
+    */
+    void async_insert(const Key &key){
+        insert(key, 1);
+    }
+
+    void insert(const Key &key, size_t count){
+        auto it = m_counts.find(key);
+        if(it != m_counts.end()){
+            it->second += count;
+            return;
+        }
+        if(m_counts.size() >= 2 * m_capacity){
+            evict();
+        }
+        m_counts.emplace(key, m_floor + count);
+    }
+
+    /*
+        @brief
+            returns the k keys with the largest estimated counts over all ranks, ordered by comp, on every rank.
+            Same call and result type as counting_set::gather_topk(). Must be called by all ranks.
+    */
+    template <typename Compare>
+    std::vector<std::pair<Key, size_t>> gather_topk(size_t k, Compare comp){
+        // each rank only sends its strongest candidates; a global top-k key is near the top of most ranks
+        std::vector<std::pair<Key, size_t>> local(m_counts.begin(), m_counts.end());
+        size_t keep = std::min(local.size(), std::min(m_capacity, candidates_per_k * k));
+        std::partial_sort(local.begin(), local.begin() + keep, local.end(), comp);
+        local.resize(keep);
+
+        auto merge = [](auto psketch, const std::vector<std::pair<Key, size_t>> &summary){
+            for(const auto &[key, count] : summary){
+                psketch->m_merged[key] += count;
+            }
+        };
+        m_merged.clear();
+        m_comm.async(0, merge, pthis, local);
+        m_comm.barrier();
+
+        auto set_result = [](auto psketch, const std::vector<std::pair<Key, size_t>> &result){
+            psketch->m_result = result;
+        };
+        if(m_comm.rank0()){
+            std::vector<std::pair<Key, size_t>> totals(m_merged.begin(), m_merged.end());
+            size_t top = std::min(k, totals.size());
+            std::partial_sort(totals.begin(), totals.begin() + top, totals.end(), comp);
+            totals.resize(top);
+            m_result = totals;
+            m_comm.async_bcast(set_result, pthis, totals);
+        }
+        m_comm.barrier();
+        m_merged = {};
+        return m_result;
+    }
+
+    /*
+        @brief largest possible overestimate of a local count
+    */
+    size_t local_error() const {
+        return m_floor;
+    }
+
+    size_t local_size() const {
+        return m_counts.size();
+    }
+
+    size_t local_bytes() const {
+        return m_counts.bucket_count() * sizeof(std::pair<Key, size_t>);
+    }
+
+private:
+    static constexpr size_t candidates_per_k = 16;
+
+    /*
+        @brief keeps the capacity largest counters and raises the floor to the largest dropped count
+    */
+    void evict(){
+        std::vector<std::pair<Key, size_t>> entries(m_counts.begin(), m_counts.end());
+        auto by_count = [](const std::pair<Key, size_t> &lhs, const std::pair<Key, size_t> &rhs){
+            return lhs.second > rhs.second;
+        };
+        std::nth_element(entries.begin(), entries.begin() + m_capacity, entries.end(), by_count);
+        m_floor = entries[m_capacity].second;
+        m_counts.clear();
+        m_counts.insert(entries.begin(), entries.begin() + m_capacity);
+    }
+
+    ygm::comm                                        &m_comm;
+    typename ygm::ygm_ptr<self_type>                 pthis;
+    size_t                                           m_capacity;
+    size_t                                           m_floor = 0;
+    boost::unordered_flat_map<Key, size_t>           m_counts;
+    boost::unordered_flat_map<Key, size_t>           m_merged;   // rank 0 only, while gather_topk() runs
+    std::vector<std::pair<Key, size_t>>              m_result;
+};
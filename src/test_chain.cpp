@@ -0,0 +1,73 @@
+#include "chain_product.hpp"
+#include <stdio.h>
+#include <cstdlib>
+#include <string>
+
+
+/*
+    usage: test_chain <k> <matrix.csv>                  computes A^k
+           test_chain <k> <M0.csv> <M1.csv> ...         computes M0 * M1 * ... (k is ignored)
+*/
+int main(int argc, char** argv){
+
+    ygm::comm world(&argc, &argv);
+
+    //#define UNDIRECTED_GRAPH
+    //#define MATRIX_OUTPUT
+    //#define HYBRID_THREADS
+
+    YGM_ASSERT_RELEASE(argc >= 3);
+    int k = std::atoi(argv[1]);
+    std::vector<std::string> filenames(argv + 2, argv + argc);
+
+    bool symmetrize = false;
+    #ifdef UNDIRECTED_GRAPH
+        symmetrize = true;
+    #endif
+
+    spgemm_options options;
+    #ifdef HYBRID_THREADS
+        options.num_threads = 0;
+    #endif
+
+    double parse_start = MPI_Wtime();
+    std::vector<std::unique_ptr<ygm::container::array<Edge>>> inputs;
+    std::vector<ygm::container::array<Edge>*> operands;
+    for(const std::string &filename : filenames){
+        inputs.push_back(load_edge_array(world, filename, false, symmetrize));
+        operands.push_back(inputs.back().get());
+    }
+    double parse_end = MPI_Wtime();
+    world.cout0("parsing time: ", parse_end - parse_start);
+
+    double multiply_start = MPI_Wtime();
+    std::unique_ptr<Sorted_COO> product;
+    if(operands.size() == 1){
+        product = matrix_power(world, *operands[0], k, options);
+    }
+    else{
+        product = multiply_chain(world, operands, options);
+    }
+    double multiply_end = MPI_Wtime();
+    world.cout0("chain multiplication time: ", multiply_end - multiply_start);
+    world.cout0("nonzeros of the product: ", product->matrix().size());
+
+    #ifdef MATRIX_OUTPUT
+        std::string output_filename = "./chain_output.csv";
+        std::ofstream output(output_filename, std::ios::out | std::ios::trunc);
+        world.barrier();
+        output.close();
+        world.barrier();
+        for(int i = 0; i < world.size(); i++){
+            if(i == world.rank()){
+                std::ofstream output(output_filename, std::ios::out | std::ios::app);
+                product->matrix().local_for_all([&output](int index, Edge &ed){
+                    output << ed.row << "," << ed.col << "," << ed.value << "\n";
+                });
+            }
+            world.barrier();
+        }
+    #endif
+
+    return 0;
+}
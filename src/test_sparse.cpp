@@ -1,4 +1,7 @@
 #include "sorted_coo.hpp"
+#include "flat_accumulator/flat_accumulator.hpp"
+#include "space_saving/space_saving.hpp"
+#include "edge_io.hpp"
 #include <ygm/container/bag.hpp>
 #include <ygm/io/csv_parser.hpp>
 #include <stdio.h>
@@ -29,9 +32,60 @@ int main(int argc, char** argv){
     std::string filename_A = epinions;
     std::string filename_B = epinions;
 
+    // uncomment SAVE_SNAPSHOT to write A and the sorted B to binary snapshots after the setup,
+    // and LOAD_SNAPSHOT to start later runs from them instead of the CSV files
+    //#define SAVE_SNAPSHOT
+    //#define LOAD_SNAPSHOT
+    std::string snapshot_prefix = "./snapshot";
+    // uncomment this to estimate the top-k rows and columns with per-rank heavy-hitter sketches merged once
+    // instead of counting them exactly with counting sets (one message per edge). A sketched count can
+    // exceed the true one by up to the sum of the ranks' local_error() floors, so near ties the top-k may differ.
+    //#define SKETCH_TOP_K
+    // uncomment this to read A during the multiplication instead of loading it first: B is parsed and
+    // sorted, then every A line is dispatched to the row owners as soon as it is parsed
+    //#define PIPELINED
+    #if defined(PIPELINED) && !defined(TRANSPOSE) && !defined(UNDIRECTED_GRAPH)
+    #error "PIPELINED takes the top rows of A from the top columns of B, so it needs B = A^T (TRANSPOSE or UNDIRECTED_GRAPH)"
+    #endif
+    // comment this out to skip the per-phase memory report (rss and structure sizes, max / mean over ranks)
+    #define MEMORY_FOOTPRINT
+    #ifdef MEMORY_FOOTPRINT
+    memory_footprint memory(world);
+    #else
+    memory_footprint memory(world, false);
+    #endif
+    // uncomment AUTOTUNE to pick top-k, hub rows and message batching from a sample of the product stream
+    // and write them to tuned_file, and LOAD_TUNED to start later runs on the same graph from that file
+    //#define AUTOTUNE
+    //#define LOAD_TUNED
+    #if defined(AUTOTUNE) && defined(PIPELINED)
+    #error "AUTOTUNE samples the product stream of a loaded A, which PIPELINED never builds"
+    #endif
+    std::string tuned_file = "./spgemm_tuned.cfg";
+    tuned_config tuned;
+    #ifdef LOAD_TUNED
+    tuned = load_tuned_config(tuned_file);
+    #endif
+
+    // A's local part, listed in every memory record from the point A exists; a streamed A (PIPELINED) holds none
+    size_t A_bytes = 0;
+    #ifdef LOAD_SNAPSHOT
+    double setup_start = MPI_Wtime();
+    size_t k = tuned.top_k;
+    std::unique_ptr<ygm::container::array<Edge>> snapshot_A = load_edge_snapshot(world, snapshot_prefix + "_A");
+    ygm::container::array<Edge> &unsorted_matrix = *snapshot_A;
+    A_bytes = unsorted_matrix.local_size() * sizeof(Edge);
+    std::unique_ptr<Sorted_COO> snapshot_B = Sorted_COO::load_snapshot(world, snapshot_prefix + "_B");
+    Sorted_COO &test_COO = *snapshot_B;
+    #else
+    #ifndef PIPELINED
      // Task 1: data extraction
     auto bagap = std::make_unique<ygm::container::bag<Edge>>(world);
+    #ifdef SKETCH_TOP_K
+    space_saving<int> top_rows(world);
+    #else
     ygm::container::counting_set<int> top_rows(world);
+    #endif
     std::vector<std::string> files_A= {filename_A};
     std::fstream file_A(files_A[0]);
     YGM_ASSERT_RELEASE(file_A.is_open() == true);
@@ -58,74 +112,268 @@ int main(int argc, char** argv){
     });
     world.barrier();
 
+    memory.record("parse A", {{"bag A", bagap->local_size() * sizeof(Edge)}});
     ygm::container::array<Edge> unsorted_matrix(world, *bagap);
     bagap.reset();
+    A_bytes = unsorted_matrix.local_size() * sizeof(Edge);
+    memory.record("array A", {{"A", A_bytes}});
+    #endif
 
     // matrix B data extraction
-    auto bagbp = std::make_unique<ygm::container::bag<Edge>>(world);
+    #ifdef SKETCH_TOP_K
+    space_saving<int> top_cols(world);
+    #else
     ygm::container::counting_set<int> top_cols(world);
-    std::vector<std::string> files_B= {filename_B};
-    std::fstream file_B(files_B[0]);
-    YGM_ASSERT_RELEASE(file_B.is_open() == true);
-    file_B.close();
-    ygm::io::csv_parser parser_B(world, files_B);
-    parser_B.for_all([&](ygm::io::detail::csv_line line){
+    #endif
+    std::unique_ptr<ygm::container::array<Edge>> matrix_B;
+    bool B_is_transpose = false;
+    #if defined(TRANSPOSE) && !defined(PIPELINED)
+    if(filename_B == filename_A){
+        // B = A^T: transpose the parsed A instead of reading the file again.
+        // It comes back row-sorted, and its top columns are the top rows of A.
+        matrix_B = transpose_edges(world, unsorted_matrix);
+        B_is_transpose = true;
+    }
+    #endif
+    if(!matrix_B){
+        auto bagbp = std::make_unique<ygm::container::bag<Edge>>(world);
+        std::vector<std::string> files_B= {filename_B};
+        std::fstream file_B(files_B[0]);
+        YGM_ASSERT_RELEASE(file_B.is_open() == true);
+        file_B.close();
+        ygm::io::csv_parser parser_B(world, files_B);
+        parser_B.for_all([&](ygm::io::detail::csv_line line){
 
-        int row = line[0].as_integer();
-        int col = line[1].as_integer();
-        int value = 1;
-        if(line.size() == 3){
-            value = line[2].as_integer();
-        }
-        #if defined(UNDIRECTED_GRAPH) || defined(TRANSPOSE)
-            Edge rev = {col, row, value};
-            bagbp->async_insert(rev);
-            top_cols.async_insert(row);
-        #endif
+            int row = line[0].as_integer();
+            int col = line[1].as_integer();
+            int value = 1;
+            if(line.size() == 3){
+                value = line[2].as_integer();
+            }
+            #if defined(UNDIRECTED_GRAPH) || defined(TRANSPOSE)
+                Edge rev = {col, row, value};
+                bagbp->async_insert(rev);
+                top_cols.async_insert(row);
+            #endif
 
 
-        #ifndef TRANSPOSE
-            Edge ed = {row, col, value};
-            bagbp->async_insert(ed);
-            top_cols.async_insert(col);
-        #endif
-    });
-    world.barrier();
+            #ifndef TRANSPOSE
+                Edge ed = {row, col, value};
+                bagbp->async_insert(ed);
+                top_cols.async_insert(col);
+            #endif
+        });
+        world.barrier();
 
-    ygm::container::array<Edge> sorted_matrix(world, *bagbp);
-    bagbp.reset();
+        memory.record("parse B", {{"A", A_bytes}, {"bag B", bagbp->local_size() * sizeof(Edge)}});
+        matrix_B = std::make_unique<ygm::container::array<Edge>>(world, *bagbp);
+        bagbp.reset();
+    }
+    ygm::container::array<Edge> &sorted_matrix = *matrix_B;
+    memory.record("array B", {{"A", A_bytes}, {"B", sorted_matrix.local_size() * sizeof(Edge)}});
 
     double setup_start = MPI_Wtime();
-    size_t k = 100;
+    size_t k = tuned.top_k;
     auto comp_count = [](const std::pair<int, size_t>& lhs, const std::pair<int, size_t>& rhs){
         if(lhs.second == rhs.second){
             return lhs.first < rhs.first;
         }
         return lhs.second > rhs.second;
     };
-    std::vector<std::pair<int, size_t>> ktop_cols = top_cols.gather_topk(k, comp_count);
-    std::vector<std::pair<int, size_t>> ktop_rows = top_rows.gather_topk(k, comp_count);
+    size_t gather_k = k;
+    #ifdef AUTOTUNE
+    gather_k = std::max<size_t>(k, 400);   // the largest top-k the tuner tries
+    #endif
+    #ifdef PIPELINED
+    // A has not been read yet; with B = A^T (or a symmetric A) the top rows of A are the top columns of B
+    YGM_ASSERT_RELEASE(filename_B == filename_A);
+    std::vector<std::pair<int, size_t>> ktop_cols = top_cols.gather_topk(gather_k, comp_count);
+    std::vector<std::pair<int, size_t>> ktop_rows = ktop_cols;
+    #else
+    std::vector<std::pair<int, size_t>> ktop_rows = top_rows.gather_topk(gather_k, comp_count);
+    std::vector<std::pair<int, size_t>> ktop_cols = B_is_transpose ? ktop_rows : top_cols.gather_topk(gather_k, comp_count);
+    #endif
     world.barrier();
-    Sorted_COO test_COO(world, sorted_matrix, k, ktop_rows, ktop_cols);
+    Sorted_COO test_COO(world, sorted_matrix, k, ktop_rows, ktop_cols, B_is_transpose);
+    #ifdef AUTOTUNE
+    tuned = test_COO.tune(unsorted_matrix, ktop_rows, ktop_cols);
+    k = tuned.top_k;
+    test_COO.set_top_pairs(k, ktop_rows, ktop_cols);
+    save_tuned_config(world, tuned, tuned_file);
+    #endif
+    #ifdef SAVE_SNAPSHOT
+    #ifndef PIPELINED
+    save_edge_snapshot(world, unsorted_matrix, snapshot_prefix + "_A");
+    #endif
+    test_COO.save_snapshot(snapshot_prefix + "_B");
+    #endif
+    #endif
+    // uncomment this to copy the highest-degree rows of B to every rank
+    //#define HUB_ROWS
+    #ifdef HUB_ROWS
+    test_COO.replicate_hub_rows(tuned.num_hubs);
+    #endif
+    // uncomment this to look up row owners in a per-row table instead of searching the rank ranges
+    //#define OWNER_TABLE
+    #ifdef OWNER_TABLE
+    test_COO.build_owner_table();
+    #endif
+    // uncomment this to read the B rows of the other ranks on the node from shared memory
+    //#define NODE_SHARED_B
+    #ifdef NODE_SHARED_B
+    test_COO.share_node_slices();
+    #endif
     double setup_end = MPI_Wtime();
     world.cout0("setup time: ", setup_end - setup_start);
+    memory.record("setup", {{"A", A_bytes}, {"B", test_COO.local_bytes()}});
 
+    spgemm_options options;
+    options.memory = &memory;
+    options.batch_size = tuned.batch_size;
+    // uncomment this to run fewer ranks per node, each multiplying with a pool of threads
+    //#define HYBRID_THREADS
+    #ifdef HYBRID_THREADS
+    options.num_threads = 0; // hardware threads / ranks per node
+    #endif
+    // uncomment this to relay messages for other nodes through one rank per node
+    //#define TWO_HOP_ROUTING
+    #ifdef TWO_HOP_ROUTING
+    options.two_hop_routing = true;
+    #endif
+    // uncomment this to sort and combine outgoing partial products before they are sent to C
+    //#define ESC_COMBINE
+    #ifdef ESC_COMBINE
+    options.esc_buffer_entries = tuned.esc_buffer_entries;
+    #endif
+    // uncomment this to delta/varint pack the batched messages (needs HYBRID_THREADS or ESC_COMBINE)
+    //#define COMPRESS_MESSAGES
+    #ifdef COMPRESS_MESSAGES
+    options.compress_messages = true;
+    #endif
+    // uncomment this to multiply A in row batches that fit a per-rank memory budget
+    //#define MEMORY_BUDGET
+    #ifdef MEMORY_BUDGET
+    options.memory_budget = size_t(2) << 30;
+    #endif
+    // with MEMORY_BUDGET: uncomment this to print the timing and message statistics of every batch
+    //#define BATCH_STATS
+    #ifdef BATCH_STATS
+    options.print_batch_stats = true;
+    #endif
+    // with MEMORY_BUDGET: uncomment this to write finished C rows to local disk after every batch
+    //#define SPILL_C
+    #ifdef SPILL_C
+    options.spill_prefix = "./C_spill";
+    #endif
+    // uncomment this to compute and store only the entries of C with row <= col (C = A * A^T is symmetric,
+    // so this needs TRANSPOSE with filename_B == filename_A, or UNDIRECTED_GRAPH with B = A)
+    //#define UPPER_TRIANGLE
+    #ifdef UPPER_TRIANGLE
+    options.upper_triangle = true;
+    #endif
+
+    // uncomment this to accumulate C in a flat_accumulator (open addressing over one block of packed keys and
+    // values that doubles and is rehashed as it fills) instead of the ygm::container::map
+    //#define FLAT_ACCUMULATOR
+    #ifdef FLAT_ACCUMULATOR
+    flat_accumulator<map_key, int> matrix_C(world);
+    #else
     ygm::container::map<map_key, int> matrix_C(world); 
+    #endif
+    // uncomment this to get C back as a row-sorted Sorted_COO instead of an accumulator
+    //#define SORTED_OUTPUT
+    // uncomment this to keep only the 10 largest entries of every row of C (returned like SORTED_OUTPUT)
+    //#define PRUNED_OUTPUT
+    #ifdef PRUNED_OUTPUT
+    #define SORTED_OUTPUT
+    prune_options prune;
+    prune.row_top_k = 10;
+    #endif
+    #if defined(PIPELINED) && !defined(LOAD_SNAPSHOT)
+    bool symmetrize_A = false;
+    #ifdef UNDIRECTED_GRAPH
+    symmetrize_A = true;
+    #endif
+    csv_edge_stream unsorted_matrix(world, filename_A, false, symmetrize_A);
+    #endif
     double spgemm_start = MPI_Wtime();
-    test_COO.spGemm(unsorted_matrix, matrix_C);
+    #if defined(PRUNED_OUTPUT)
+    std::unique_ptr<Sorted_COO> sorted_C = test_COO.spGemm_pruned(unsorted_matrix, prune, options);
+    #elif defined(SORTED_OUTPUT)
+    std::unique_ptr<Sorted_COO> sorted_C = test_COO.spGemm_to_sorted(unsorted_matrix, options);
+    #else
+    test_COO.spGemm(unsorted_matrix, matrix_C, options);
+    #endif
     world.barrier();
     double spgemm_end = MPI_Wtime();    
     world.cout0("Total number of cores: ", world.size());
     world.cout0("matrix multiplication time: ", spgemm_end - spgemm_start);
+    // uncomment this to add the edges of delta_file to the graph after the multiplication and bring C up to
+    // date with spGemm_update() instead of multiplying again. Needs B = A^T (TRANSPOSE with B = A, or
+    // UNDIRECTED_GRAPH) and C in an accumulator (no SORTED_OUTPUT or SPILL_C).
+    //#define INCREMENTAL_UPDATE
+    #if defined(INCREMENTAL_UPDATE) && !defined(SORTED_OUTPUT) && !defined(SPILL_C)
+    std::string delta_file = "./delta_edges.csv";
+    std::fstream file_delta(delta_file);
+    YGM_ASSERT_RELEASE(file_delta.is_open() == true);
+    file_delta.close();
+    std::vector<Edge> new_B_edges;
+    ygm::io::csv_parser parser_delta(world, std::vector<std::string>{delta_file});
+    parser_delta.for_all([&](ygm::io::detail::csv_line line){
+        int row = line[0].as_integer();
+        int col = line[1].as_integer();
+        int value = 1;
+        if(line.size() == 3){
+            value = line[2].as_integer();
+        }
+        // a new A edge (row, col) is the B entry (col, row)
+        new_B_edges.push_back({col, row, value});
+        #ifdef UNDIRECTED_GRAPH
+        if(row != col){
+            new_B_edges.push_back({row, col, value});
+        }
+        #endif
+    });
+    world.barrier();
+    double update_start = MPI_Wtime();
+    test_COO.add_delta(new_B_edges);
+    test_COO.spGemm_update(test_COO, matrix_C, options);
+    double update_end = MPI_Wtime();
+    world.cout0("incremental update time: ", update_end - update_start);
+    #endif
+    #ifdef SORTED_OUTPUT
+    memory.record("sorted C", {{"A", A_bytes}, {"C", sorted_C->local_bytes()}});
+    #endif
 
     #define MATRIX_OUTPUT
     #ifdef MATRIX_OUTPUT
    
     ygm::container::bag<Edge> global_bag_C(world);
-    matrix_C.for_all([&global_bag_C](map_key coord, int product){
-        global_bag_C.async_insert({coord.x, coord.y, product});
+    // with UPPER_TRIANGLE: comment this out to write only the stored half of C
+    #define MIRROR_OUTPUT
+    auto output_edge = [&global_bag_C](const Edge &ed){
+        global_bag_C.async_insert(ed);
+        #if defined(UPPER_TRIANGLE) && defined(MIRROR_OUTPUT)
+        if(ed.row != ed.col){
+            global_bag_C.async_insert({ed.col, ed.row, ed.value});
+        }
+        #endif
+    };
+    #ifdef SORTED_OUTPUT
+    sorted_C->matrix().for_all([&output_edge](int index, Edge &ed){
+        output_edge(ed);
+    });
+    #elif defined(SPILL_C)
+    for(const Edge &ed : read_spilled_edges(options.spill_prefix, world.rank())){
+        output_edge(ed);
+    }
+    #else
+    matrix_C.for_all([&output_edge](map_key coord, int product){
+        output_edge({coord.x, coord.y, product});
     });
+    #endif
     world.barrier();
+    memory.record("bag C", {{"A", A_bytes}, {"bag C", global_bag_C.local_size() * sizeof(Edge)}});
 
     std::vector<Edge> sorted_output_C;
     global_bag_C.gather(sorted_output_C, 0);
@@ -169,6 +417,7 @@ int main(int argc, char** argv){
         #endif
     }
     #endif
+    memory.print_summary();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "sorted_coo.hpp"
+#include "edge_io.hpp"
+#include <ygm/container/bag.hpp>
+#include <stdio.h>
+#include <cstdlib>
+#include <string>
+
+
+/*
+    usage: test_spmm <matrix.csv> [iterations] [width]
+
+    Runs PageRank on the graph with spmv()/spmm_transpose(), then one SpMM with a dense block of "width" columns.
+    With CHECK_RESULTS both are recomputed serially on rank 0 and compared.
+*/
+int main(int argc, char** argv){
+
+    ygm::comm world(&argc, &argv);
+
+    //#define UNDIRECTED_GRAPH
+    //#define MATRIX_OUTPUT
+    // uncomment this to check the results against a serial computation on rank 0 (small graphs only)
+    //#define CHECK_RESULTS
+
+    YGM_ASSERT_RELEASE(argc >= 2);
+    std::string filename = argv[1];
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+    int width = argc > 3 ? std::atoi(argv[3]) : 16;
+
+    bool symmetrize = false;
+    #ifdef UNDIRECTED_GRAPH
+        symmetrize = true;
+    #endif
+
+    double setup_start = MPI_Wtime();
+    Sorted_COO graph(world, load_edge_array(world, filename, false, symmetrize), false);
+    int local_max = -1;
+    graph.matrix().local_for_all([&local_max](int index, Edge &ed){
+        local_max = std::max(local_max, std::max(ed.row, ed.col));
+    });
+    size_t n = ygm::max(local_max, world) + 1;
+    double setup_end = MPI_Wtime();
+    world.cout0("setup time: ", setup_end - setup_start, ", vertices: ", n);
+
+    // out-degrees (weighted): B * 1
+    dense_matrix<double> ones(world, n, 1, 1.0);
+    dense_matrix<double> degree(world, n, 1);
+    graph.spmv(ones, degree);
+
+    /*
+        PageRank: rank' = (1 - d) / n + d * (B^T (rank / degree) + dangling mass / n)
+    */
+    double damping = 0.85;
+    dense_matrix<double> rank(world, n, 1, 1.0 / n);
+    dense_matrix<double> scaled(world, n, 1);
+    dense_matrix<double> incoming(world, n, 1);
+    double pagerank_start = MPI_Wtime();
+    for(int it = 0; it < iterations; it++){
+        double local_dangling = 0;
+        for(size_t i = 0; i < rank.local_rows(); i++){
+            size_t row = rank.local_start() + i;
+            double deg = *degree.local_row(row);
+            double r = *rank.local_row(row);
+            if(deg > 0){
+                *scaled.local_row(row) = r / deg;
+            }
+            else{
+                *scaled.local_row(row) = 0;
+                local_dangling += r;
+            }
+        }
+        double dangling = ygm::sum(local_dangling, world);
+        graph.spmm_transpose(scaled, incoming);
+
+        double local_delta = 0;
+        rank.local_for_all([&](size_t row, double *r){
+            double updated = (1 - damping) / n + damping * (*incoming.local_row(row) + dangling / n);
+            local_delta += std::abs(updated - *r);
+            *r = updated;
+        });
+        double delta = ygm::sum(local_delta, world);
+        world.cout0("pagerank iteration ", it, ": L1 change ", delta);
+    }
+    double pagerank_end = MPI_Wtime();
+    world.cout0("pagerank time: ", pagerank_end - pagerank_start);
+
+    // one propagation step of a width-column embedding: Y = B * X
+    dense_matrix<double> X(world, n, width);
+    X.local_for_all([width](size_t row, double *values){
+        for(int c = 0; c < width; c++){
+            values[c] = double((row + c) % 7);
+        }
+    });
+    dense_matrix<double> Y(world, n, width);
+    graph.spmm(X, Y);
+
+    #ifdef MATRIX_OUTPUT
+        std::string output_filename = "./spmm_output.csv";
+        std::ofstream output(output_filename, std::ios::out | std::ios::trunc);
+        world.barrier();
+        output.close();
+        world.barrier();
+        for(int i = 0; i < world.size(); i++){
+            if(i == world.rank()){
+                std::ofstream output(output_filename, std::ios::out | std::ios::app);
+                output.precision(10);
+                for(size_t j = 0; j < rank.local_rows(); j++){
+                    size_t row = rank.local_start() + j;
+                    output << row << "," << *rank.local_row(row);
+                    for(int c = 0; c < width; c++){
+                        output << "," << Y.local_row(row)[c];
+                    }
+                    output << "\n";
+                }
+            }
+            world.barrier();
+        }
+    #endif
+
+    #ifdef CHECK_RESULTS
+        ygm::container::bag<Edge> edge_bag(world);
+        graph.matrix().for_all([&edge_bag](int index, Edge &ed){
+            edge_bag.async_insert(ed);
+        });
+        world.barrier();
+        std::vector<Edge> edges;
+        edge_bag.gather(edges, 0);
+
+        // rank 0 collects every row as its PageRank value followed by its row of Y
+        size_t stride = 1 + width;
+        std::vector<double> collected(world.rank0() ? n * stride : 0);
+        auto collected_ptr = world.make_ygm_ptr(collected);
+        auto receive_rows = [](auto pcollected, size_t offset, const std::vector<double> &values){
+            std::copy(values.begin(), values.end(), pcollected->begin() + offset);
+        };
+        std::vector<double> local_values;
+        for(size_t j = 0; j < rank.local_rows(); j++){
+            size_t row = rank.local_start() + j;
+            local_values.push_back(*rank.local_row(row));
+            local_values.insert(local_values.end(), Y.local_row(row), Y.local_row(row) + width);
+        }
+        world.async(0, receive_rows, collected_ptr, rank.local_start() * stride, local_values);
+        world.barrier();
+
+        if(world.rank0()){
+            std::vector<double> ref_degree(n, 0);
+            for(const Edge &ed : edges){
+                ref_degree[ed.row] += ed.value;
+            }
+            std::vector<double> ref_rank(n, 1.0 / n);
+            std::vector<double> ref_incoming(n);
+            for(int it = 0; it < iterations; it++){
+                double dangling = 0;
+                std::fill(ref_incoming.begin(), ref_incoming.end(), 0.0);
+                for(size_t row = 0; row < n; row++){
+                    if(ref_degree[row] <= 0){
+                        dangling += ref_rank[row];
+                    }
+                }
+                for(const Edge &ed : edges){
+                    ref_incoming[ed.col] += ed.value * ref_rank[ed.row] / ref_degree[ed.row];
+                }
+                for(size_t row = 0; row < n; row++){
+                    ref_rank[row] = (1 - damping) / n + damping * (ref_incoming[row] + dangling / n);
+                }
+            }
+            std::vector<double> ref_Y(n * width, 0);
+            for(const Edge &ed : edges){
+                for(int c = 0; c < width; c++){
+                    ref_Y[size_t(ed.row) * width + c] += ed.value * double((ed.col + c) % 7);
+                }
+            }
+
+            double rank_error = 0;
+            double y_error = 0;
+            double y_scale = 1;
+            for(size_t row = 0; row < n; row++){
+                rank_error = std::max(rank_error, std::abs(collected[row * stride] - ref_rank[row]));
+                for(int c = 0; c < width; c++){
+                    double expected = ref_Y[row * width + c];
+                    y_error = std::max(y_error, std::abs(collected[row * stride + 1 + c] - expected));
+                    y_scale = std::max(y_scale, std::abs(expected));
+                }
+            }
+            bool passed = rank_error <= 1e-12 && y_error <= 1e-12 * y_scale;
+            printf("check against serial reference: max pagerank error %g, max Y error %g: %s\n",
+                   rank_error, y_error, passed ? "passed" : "FAILED");
+        }
+        world.barrier();
+    #endif
+
+    return 0;
+}
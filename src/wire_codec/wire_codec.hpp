@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+
+/*
+    Byte packing for batches of (packed key, value) pairs sent between ranks.
+
+    The keys of a batch must be sorted in ascending order. They are written as the differences between
+    consecutive keys in LEB128 varints, so a batch to one owner, whose keys share the row bits and have
+    close column bits, costs one or two bytes per key instead of eight. Values are zigzag varints. When
+    every value of a batch is 1 (pattern-only matrices, counts that did not combine) the values are
+    dropped and restored on decoding.
+
+    Layout: varint count | flags byte | count key deltas | count values (unless flag_unit_values)
+*/
+template <typename Value>
+class wire_codec{
+    static_assert(std::is_integral_v<Value>);
+
+public:
+    using key_type = uint64_t;
+    using value_type = Value;
+
+    /**
+     * @brief appends the encoding of (keys[i], values[i]) to out
+     *
+     * @param keys : sorted in ascending order
+     * @return number of bytes appended
+     */
+    static size_t encode(const std::vector<key_type> &keys, const std::vector<Value> &values, std::vector<uint8_t> &out){
+        size_t start = out.size();
+        bool unit_values = std::all_of(values.begin(), values.end(), [](Value v){ return v == 1; });
+        out.reserve(start + 2 + keys.size() * (unit_values ? 3 : 4));
+
+        put_varint(out, keys.size());
+        out.push_back(unit_values ? flag_unit_values : 0);
+        key_type previous = 0;
+        for(key_type key : keys){
+            put_varint(out, key - previous);
+            previous = key;
+        }
+        if(!unit_values){
+            for(Value v : values){
+                put_varint(out, zigzag(v));
+            }
+        }
+        return out.size() - start;
+    }
+
+    /**
+     * @brief decodes one batch starting at in[pos] into keys and values (replacing their contents)
+     *
+     * @return position after the batch
+     */
+    static size_t decode(const std::vector<uint8_t> &in, std::vector<key_type> &keys, std::vector<Value> &values,
+                         size_t pos = 0){
+        size_t count = get_varint(in, pos);
+        uint8_t flags = in[pos++];
+        keys.resize(count);
+        values.resize(count);
+        key_type previous = 0;
+        for(size_t i = 0; i < count; i++){
+            previous += get_varint(in, pos);
+            keys[i] = previous;
+        }
+        if(flags & flag_unit_values){
+            std::fill(values.begin(), values.end(), Value(1));
+        }
+        else{
+            for(size_t i = 0; i < count; i++){
+                values[i] = unzigzag(get_varint(in, pos));
+            }
+        }
+        return pos;
+    }
+
+    /**
+     * @brief bytes the same batch takes as a pair of plain vectors
+     */
+    static size_t raw_bytes(size_t count){
+        return count * (sizeof(key_type) + sizeof(Value));
+    }
+
+private:
+    static constexpr uint8_t flag_unit_values = 1;
+
+    static void put_varint(std::vector<uint8_t> &out, uint64_t v){
+        while(v >= 0x80){
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    static uint64_t get_varint(const std::vector<uint8_t> &in, size_t &pos){
+        uint64_t v = 0;
+        int shift = 0;
+        while(in[pos] & 0x80){
+            v |= uint64_t(in[pos++] & 0x7f) << shift;
+            shift += 7;
+        }
+        v |= uint64_t(in[pos++]) << shift;
+        return v;
+    }
+
+    static uint64_t zigzag(Value v){
+        int64_t s = int64_t(v);
+        return (uint64_t(s) << 1) ^ uint64_t(s >> 63);
+    }
+
+    static Value unzigzag(uint64_t v){
+        return Value(int64_t(v >> 1) ^ -int64_t(v & 1));
+    }
+};